@@ -0,0 +1,57 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIOSOURCE_H
+#define AUDIOSOURCE_H
+
+#include <string>
+
+#include "clientmessage.h"
+#include "util/inclstdint.h"
+
+//base class for everything that can feed audio into CBitVis
+class CAudioSource
+{
+  public:
+    virtual ~CAudioSource() {}
+
+    virtual bool Connect() = 0;
+    virtual void Disconnect() = 0;
+    virtual bool IsConnected() = 0;
+
+    //returns the number of samples in buf, buf points to memory owned by the source
+    //which stays valid until the next call
+    //audiotime is the timestamp in microseconds of the first sample
+    virtual int  GetAudio(float*& buf, int& samplerate, int64_t& audiotime) = 0;
+
+    //returns non-zero when the source has exited because of an error
+    virtual int                ExitStatus() { return 0; }
+    virtual const std::string& ExitReason() { return m_exitreason; }
+    virtual ClientMessage      GetMessage() { return MsgNone; }
+
+    //number of blocks dropped because the consumer didn't keep up
+    virtual int64_t Overruns() { return 0; }
+
+    //returns true when the source will not deliver any more audio
+    virtual bool Finished() { return false; }
+
+  protected:
+    std::string m_exitreason;
+};
+
+#endif //AUDIOSOURCE_H
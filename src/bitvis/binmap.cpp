@@ -0,0 +1,245 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <strings.h>
+
+#include "binmap.h"
+#include "util/misc.h"
+#include "util/log.h"
+
+//frequency range of the log, mel and bark scales
+#define MINFREQ 40.0f
+#define MAXFREQ 15000.0f
+
+static float ToScale(FrequencyScale scale, float freq)
+{
+  if (scale == ScaleMel)
+    return 2595.0f * log10f(1.0f + freq / 700.0f);
+  else if (scale == ScaleBark)
+    return 26.81f * freq / (1960.0f + freq) - 0.53f;
+  else
+    return logf(freq);
+}
+
+static float FromScale(FrequencyScale scale, float value)
+{
+  if (scale == ScaleMel)
+    return 700.0f * (powf(10.0f, value / 2595.0f) - 1.0f);
+  else if (scale == ScaleBark)
+    return 1960.0f * (value + 0.53f) / (26.28f - value);
+  else
+    return expf(value);
+}
+
+CBinMap::CBinMap()
+{
+  m_samplerate = 0;
+  m_fftsize = 0;
+  m_nrcolumns = 0;
+  m_scale = ScaleQuadratic;
+}
+
+void CBinMap::Build(int samplerate, int fftsize, int nrcolumns, FrequencyScale scale)
+{
+  if (samplerate == m_samplerate && fftsize == m_fftsize && nrcolumns == m_nrcolumns && scale == m_scale)
+    return;
+
+  m_samplerate = samplerate;
+  m_fftsize = fftsize;
+  m_nrcolumns = nrcolumns;
+  m_scale = scale;
+
+  m_columnstart.clear();
+  m_bins.clear();
+  m_weights.clear();
+  m_columns.resize(m_nrcolumns);
+
+  if (m_scale == ScaleQuadratic)
+    BuildQuadratic();
+  else
+    BuildScale();
+
+  m_columnstart.push_back(m_bins.size());
+
+  LogDebug("Built %s bin map for %i columns, %i bins, %i weights",
+           ScaleToString(m_scale), m_nrcolumns, m_fftsize / 2, (int)m_weights.size());
+}
+
+const float* CBinMap::Apply(const float* magnitudes, float mul)
+{
+  for (int i = 0; i < m_nrcolumns; i++)
+  {
+    float value = 0.0f;
+    for (int j = m_columnstart[i]; j < m_columnstart[i + 1]; j++)
+      value += magnitudes[m_bins[j]] * m_weights[j];
+
+    m_columns[i] = value * mul;
+  }
+
+  return &m_columns[0];
+}
+
+//every column is a bit wider than the previous one, up to 15 KHz
+void CBinMap::BuildQuadratic()
+{
+  int additions = 0;
+  for (int i = 1; i < m_nrcolumns; i++)
+    additions += i;
+
+  const int maxbin = Round32(MAXFREQ / m_samplerate * m_fftsize);
+
+  float increase = (float)(maxbin - m_nrcolumns - 1) / additions;
+
+  float start = 0.0f;
+  float add = 1.0f;
+  for (int i = 0; i < m_nrcolumns; i++)
+  {
+    m_columnstart.push_back(m_bins.size());
+
+    float next = start + add;
+
+    int bin    = Round32(start) + 1;
+    int nrbins = Round32(next - start);
+    for (int j = bin; j < bin + nrbins; j++)
+      AddWeight(j, 1.0f);
+
+    start = next;
+    add += increase;
+  }
+}
+
+//the columns are evenly spaced on the scale, each column adds up the spectrum over its width
+//columns narrower than one bin interpolate between the two nearest bins
+void CBinMap::BuildScale()
+{
+  float scalemin = ToScale(m_scale, MINFREQ);
+  float scalemax = ToScale(m_scale, Min(MAXFREQ, m_samplerate / 2.0f));
+  float binsize  = (float)m_samplerate / m_fftsize;
+
+  for (int i = 0; i < m_nrcolumns; i++)
+  {
+    m_columnstart.push_back(m_bins.size());
+
+    float lower = FromScale(m_scale, scalemin + (scalemax - scalemin) * i / m_nrcolumns) / binsize;
+    float upper = FromScale(m_scale, scalemin + (scalemax - scalemin) * (i + 1) / m_nrcolumns) / binsize;
+
+    if (upper - lower < 1.0f)
+    {
+      float center = (lower + upper) * 0.5f;
+      int   bin    = (int)center;
+      float frac   = center - bin;
+
+      AddWeight(bin, 1.0f - frac);
+      AddWeight(bin + 1, frac);
+    }
+    else
+    {
+      //each bin covers half a bin on both sides of its center
+      for (int bin = (int)(lower + 0.5f); bin <= (int)(upper + 0.5f); bin++)
+      {
+        float overlap = Min(upper, bin + 0.5f) - Max(lower, bin - 0.5f);
+        if (overlap > 0.0f)
+          AddWeight(bin, overlap);
+      }
+    }
+  }
+}
+
+void CBinMap::ColumnRanges(int samplerate, int fftsize, int nrcolumns, FrequencyScale scale,
+                           std::vector<float>& lower, std::vector<float>& upper)
+{
+  lower.resize(nrcolumns);
+  upper.resize(nrcolumns);
+
+  float binsize = (float)samplerate / fftsize;
+
+  if (scale == ScaleQuadratic)
+  {
+    //same steps as BuildQuadratic(), every bin covers half a bin on both sides of its center
+    int additions = 0;
+    for (int i = 1; i < nrcolumns; i++)
+      additions += i;
+
+    const int maxbin = Round32(MAXFREQ / samplerate * fftsize);
+
+    float increase = (float)(maxbin - nrcolumns - 1) / Max(additions, 1);
+
+    float start = 0.0f;
+    float add = 1.0f;
+    for (int i = 0; i < nrcolumns; i++)
+    {
+      float next = start + add;
+
+      lower[i] = (Round32(start) + 0.5f) * binsize;
+      upper[i] = lower[i] + Round32(next - start) * binsize;
+
+      start = next;
+      add += increase;
+    }
+  }
+  else
+  {
+    float scalemin = ToScale(scale, MINFREQ);
+    float scalemax = ToScale(scale, Min(MAXFREQ, samplerate / 2.0f));
+
+    for (int i = 0; i < nrcolumns; i++)
+    {
+      lower[i] = FromScale(scale, scalemin + (scalemax - scalemin) * i / nrcolumns);
+      upper[i] = FromScale(scale, scalemin + (scalemax - scalemin) * (i + 1) / nrcolumns);
+    }
+  }
+}
+
+void CBinMap::AddWeight(int bin, float weight)
+{
+  //skip the dc bin, and everything past the last bin
+  if (bin < 1 || bin >= m_fftsize / 2 || weight <= 0.0f)
+    return;
+
+  m_bins.push_back(bin);
+  m_weights.push_back(weight);
+}
+
+const char* CBinMap::ScaleToString(FrequencyScale scale)
+{
+  if (scale == ScaleLog)
+    return "log";
+  else if (scale == ScaleMel)
+    return "mel";
+  else if (scale == ScaleBark)
+    return "bark";
+  else
+    return "quadratic";
+}
+
+bool CBinMap::StringToScale(const char* str, FrequencyScale& scale)
+{
+  if (strcasecmp(str, "quadratic") == 0)
+    scale = ScaleQuadratic;
+  else if (strcasecmp(str, "log") == 0)
+    scale = ScaleLog;
+  else if (strcasecmp(str, "mel") == 0)
+    scale = ScaleMel;
+  else if (strcasecmp(str, "bark") == 0)
+    scale = ScaleBark;
+  else
+    return false;
+
+  return true;
+}
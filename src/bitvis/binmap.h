@@ -0,0 +1,66 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BINMAP_H
+#define BINMAP_H
+
+#include <vector>
+
+enum FrequencyScale
+{
+  ScaleQuadratic,
+  ScaleLog,
+  ScaleMel,
+  ScaleBark,
+};
+
+//maps fft bins to display columns with a sparse table of weights,
+//the table is only rebuilt when one of the parameters changes
+class CBinMap
+{
+  public:
+    CBinMap();
+
+    //fftsize is the size of the fft, the number of bins is half that
+    void         Build(int samplerate, int fftsize, int nrcolumns, FrequencyScale scale);
+    const float* Apply(const float* magnitudes, float mul);
+
+    //the lower and upper edge in Hz of every column, for the layout Build() makes with the same parameters
+    static void  ColumnRanges(int samplerate, int fftsize, int nrcolumns, FrequencyScale scale,
+                              std::vector<float>& lower, std::vector<float>& upper);
+
+    static const char* ScaleToString(FrequencyScale scale);
+    static bool        StringToScale(const char* str, FrequencyScale& scale);
+
+  private:
+    void BuildQuadratic();
+    void BuildScale();
+    void AddWeight(int bin, float weight);
+
+    int            m_samplerate;
+    int            m_fftsize;
+    int            m_nrcolumns;
+    FrequencyScale m_scale;
+
+    std::vector<int>   m_columnstart; //index of the first weight of every column, with one extra at the end
+    std::vector<int>   m_bins;
+    std::vector<float> m_weights;
+    std::vector<float> m_columns;
+};
+
+#endif //BINMAP_H
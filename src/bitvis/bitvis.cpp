@@ -18,6 +18,7 @@
 
 #include "util/inclstdint.h"
 #include "bitvis.h"
+#include "filesource.h"
 #include "util/log.h"
 #include "util/misc.h"
 #include "util/timeutils.h"
@@ -36,31 +37,72 @@ using namespace std;
 
 #define CONNECTINTERVAL 1000000
 
-CBitVis::CBitVis(int argc, char *argv[])
+void CRenderThread::Process()
+{
+  while (!m_stop)
+    m_bitvis.ProcessRender();
+}
+
+CBitVis::CBitVis(int argc, char *argv[]) : m_renderthread(*this)
 {
   m_debug = false;
   m_debugscale = 2;
-  m_address = NULL;
   m_port = 1337;
+  m_connections = NULL;
+  m_delta = false;
+  m_spintime = 0;
+  m_outputlatency = 10000;
+  m_pacedframes = 0;
+  m_lateframes = 0;
+  m_staleframes = 0;
+  m_stalereported = 0;
+  m_staletime = 0;
+  m_queuedframes = 0;
+  m_maxqueuedepth = 0;
+  m_logpacing = false;
+  m_framebuf = NULL;
+  m_textbuf = NULL;
   m_mpdaddress = NULL;
   m_mpdport = 6600;
+  m_audiosource = NULL;
+  m_inputfile = NULL;
+  m_rawsamplerate = 44100;
+  m_benchmark = false;
+  m_benchframes = 0;
+  m_benchcputime = 0;
   g_printdebuglevel = true;
   m_stop = false;
   m_buf = NULL;
-  m_bufsize = 0;
-  m_fftbuf = NULL;
+  m_overruns = 0;
+  m_overruntime = 0;
+  m_snapshotread = 0;
+  m_frameread = 0;
+  m_framewrite = 0;
+  m_snapshotwrite = 0;
+  m_droppedsnapshots = 0;
+  m_droppedreported = 0;
+  m_droppedtime = 0;
   m_displaybuf = NULL;
   m_samplecounter = 0;
-  m_nrffts = 0;
   m_peakholds = NULL;
+  m_columnstate = NULL;
+  m_benchrendertime = 0;
   m_nrbins = 1024;
-  m_nrcolumns = 120;
+  m_overlap = 75;
+  m_window = WindowHamming;
+  m_scale = ScaleQuadratic;
+  m_multiresstages = 0;
   m_decay = 0.5;
   m_fps = 30;
   m_mpdclient = NULL;
+  m_mpdsongversion = 0;
+  m_mpdplayingversion = 0;
+  m_mpdvolumeversion = 0;
   m_scopebuf = NULL;
   m_scopebufsize = 0;
+  m_scopelinbuf = NULL;
   m_scopecorrbuf = NULL;
+  m_scopesearch = -1;
   m_scopedisplaybuf = NULL;
   m_scopebufpos = 0;
   m_hystime = 0;
@@ -71,17 +113,22 @@ CBitVis::CBitVis(int argc, char *argv[])
   m_srcstate = NULL;
 
   m_fontheight = 0;
+  m_stripbytes = 0;
+  m_titlepixels = 0;
   InitChars();
 
-  m_nrlines = 48;
   m_scrolloffset = 0;
   m_fontdisplay = 0;
   m_songupdatetime = GetTimeUs();
   m_volumetime = GetTimeUs();
   m_displayvolume = 0;
 
-  const char* flags = "f:d:p:a:m:o:u";
+  const char* flags = "f:d:p:a:m:o:ui:r:bw:l:s:c:g:t:ej:x:y:";
   int c;
+  int panelcolumns = 120;
+  int panellines = 48;
+  int tilesx = 1;
+  int tilesy = 1;
   while ((c = getopt(argc, argv, flags)) != -1)
   {
     if (c == 'f') //fps
@@ -118,9 +165,25 @@ CBitVis::CBitVis(int argc, char *argv[])
 
       m_port = port;
     }
-    else if (c == 'a') //address
+    else if (c == 'a') //address, can be given once for every panel, with an optional :port
+    {
+      m_addresses.push_back(optarg);
+    }
+    else if (c == 'g') //geometry of a single panel
+    {
+      if (sscanf(optarg, "%ix%i", &panelcolumns, &panellines) != 2)
+      {
+        LogError("Wrong argument \"%s\" for geometry, use <columns>x<lines>", optarg);
+        exit(1);
+      }
+    }
+    else if (c == 't') //number of panels horizontally and vertically
     {
-      m_address = optarg;
+      if (sscanf(optarg, "%ix%i", &tilesx, &tilesy) != 2)
+      {
+        LogError("Wrong argument \"%s\" for tiles, use <x>x<y>", optarg);
+        exit(1);
+      }
     }
     else if (c == 'm') //mpd address
     {
@@ -141,14 +204,153 @@ CBitVis::CBitVis(int argc, char *argv[])
     {
       m_peakup = true;
     }
+    else if (c == 'e') //only send the rows that changed, needs a receiver that understands delta frames
+    {
+      m_delta = true;
+    }
+    else if (c == 'j') //microseconds to busy wait before sending a frame, for lower jitter at the cost of cpu time
+    {
+      int spintime;
+      if (!StrToInt(string(optarg), spintime) || spintime < 0 || spintime > 10000)
+      {
+        LogError("Wrong argument \"%s\" for busy wait time", optarg);
+        exit(1);
+      }
+
+      m_spintime = spintime;
+    }
+    else if (c == 'y') //milliseconds between the audio timestamps and when the audio is heard, like the playback latency
+    {
+      int latency;
+      if (!StrToInt(string(optarg), latency) || latency < 0 || latency > 1000)
+      {
+        LogError("Wrong argument \"%s\" for output latency", optarg);
+        exit(1);
+      }
+
+      m_outputlatency = (int64_t)latency * 1000;
+    }
+    else if (c == 'i') //read audio from a file instead of jack
+    {
+      m_inputfile = optarg;
+    }
+    else if (c == 'r') //samplerate of raw input files
+    {
+      int samplerate;
+      if (!StrToInt(string(optarg), samplerate) || samplerate <= 0)
+      {
+        LogError("Wrong argument \"%s\" for raw samplerate", optarg);
+        exit(1);
+      }
+
+      m_rawsamplerate = samplerate;
+    }
+    else if (c == 'b') //benchmark the fft kernels, and process the input file as fast as possible
+    {
+      m_benchmark = true;
+    }
+    else if (c == 'w') //fft window
+    {
+      if (!Cfft::StringToWindow(optarg, m_window))
+      {
+        LogError("Wrong argument \"%s\" for window, use hamming, hann or blackmanharris", optarg);
+        exit(1);
+      }
+    }
+    else if (c == 'l') //overlap of consecutive ffts in percent
+    {
+      int overlap;
+      if (!StrToInt(string(optarg), overlap) || overlap < 0 || overlap > 95)
+      {
+        LogError("Wrong argument \"%s\" for overlap", optarg);
+        exit(1);
+      }
+
+      m_overlap = overlap;
+    }
+    else if (c == 'x') //number of decimated stages for the multiresolution spectrum, 0 uses a single fft
+    {
+      int stages;
+      if (!StrToInt(string(optarg), stages) || stages < 0 || stages > 8)
+      {
+        LogError("Wrong argument \"%s\" for multiresolution stages", optarg);
+        exit(1);
+      }
+
+      m_multiresstages = stages;
+    }
+    else if (c == 'c') //number of offsets to search for the best scope alignment
+    {
+      int search;
+      if (!StrToInt(string(optarg), search) || search <= 0)
+      {
+        LogError("Wrong argument \"%s\" for scope search window", optarg);
+        exit(1);
+      }
+
+      m_scopesearch = search;
+    }
+    else if (c == 's') //frequency scale of the spectrum
+    {
+      if (!CBinMap::StringToScale(optarg, m_scale))
+      {
+        LogError("Wrong argument \"%s\" for scale, use quadratic, log, mel or bark", optarg);
+        exit(1);
+      }
+    }
+  }
+
+  if (!m_tiler.SetLayout(panelcolumns, panellines, tilesx, tilesy))
+  {
+    LogError("Invalid panel layout %ix%i with %ix%i tiles, columns need to be a multiple of 4",
+             panelcolumns, panellines, tilesx, tilesy);
+    exit(1);
   }
 
-  if (!m_address)
+  m_nrcolumns = m_tiler.Columns();
+  m_nrlines = m_tiler.Lines();
+
+  if (!m_addresses.empty() && (int)m_addresses.size() != m_tiler.NrPanels())
+  {
+    LogError("Got %i addresses for %i panels", (int)m_addresses.size(), m_tiler.NrPanels());
+    exit(1);
+  }
+
+  //split off the port, when the address has exactly one colon
+  for (size_t i = 0; i < m_addresses.size(); i++)
+  {
+    size_t colon = m_addresses[i].find(':');
+    int    port;
+    if (colon != string::npos && m_addresses[i].rfind(':') == colon &&
+        StrToInt(m_addresses[i].substr(colon + 1), port) && port > 0 && port <= 65535)
+    {
+      m_addresses[i] = m_addresses[i].substr(0, colon);
+      m_ports.push_back(port);
+    }
+    else
+    {
+      m_ports.push_back(m_port);
+    }
+  }
+
+  if (m_addresses.empty() && !m_benchmark)
     m_debug = true;
+
+  //frames wait in the queue for the output latency, keep room for the one being rendered and the one being sent
+  const int64_t maxlatency = (int64_t)(MAXFRAMES - 2) * 1000000 / m_fps;
+  if (m_outputlatency > maxlatency)
+  {
+    LogError("Output latency of %" PRIi64 " ms doesn't fit in the frame queue, using %" PRIi64 " ms",
+             m_outputlatency / 1000, maxlatency / 1000);
+    m_outputlatency = maxlatency;
+  }
 }
 
 CBitVis::~CBitVis()
 {
+  delete m_audiosource;
+  delete[] m_connections;
+  delete[] m_textbuf;
 }
 
 void CBitVis::Setup()
@@ -156,15 +358,30 @@ void CBitVis::Setup()
   //init the logfile
   SetLogFile(".bitvis", "bitvis.log");
 
-  SetupSignals();
+  //keep the fftw wisdom next to the log, so measured fft plans are only built once
+  if (!g_logfilename.empty())
+    Cfft::SetWisdomFile(g_logfilename.substr(0, g_logfilename.rfind('/') + 1) + "fftwf_wisdom");
 
-  jack_set_error_function(JackError);
-  jack_set_info_function(JackInfo);
+  SetupSignals();
 
-  m_fft.Allocate(m_nrbins * 2);
+  if (m_inputfile)
+  {
+    m_audiosource = new CFileSource(m_inputfile, !m_benchmark, m_rawsamplerate);
+  }
+  else
+  {
+    jack_set_error_function(JackError);
+    jack_set_info_function(JackInfo);
+    m_audiosource = new CJackClient();
+  }
 
-  m_fftbuf = new float[m_nrbins];
-  memset(m_fftbuf, 0, m_nrbins * sizeof(float));
+  //the multiresolution stages use a quarter of the fft size,
+  //so two stages down they have the same bin size as the single fft,
+  //the overlap applies to the stage fft size at the full samplerate
+  if (m_multiresstages > 0)
+    m_multires.Allocate(m_multiresstages, m_nrbins / 2, Max(m_nrbins / 2 * (100 - m_overlap) / 100, 1), m_window);
+  else
+    m_fft.Allocate(m_nrbins * 2, Max(m_nrbins * 2 * (100 - m_overlap) / 100, 1), m_window);
 
   m_displaybuf = new float[m_nrcolumns];
   memset(m_displaybuf, 0, m_nrcolumns * sizeof(float));
@@ -172,10 +389,22 @@ void CBitVis::Setup()
   m_peakholds = new peak[m_nrcolumns];
   memset(m_peakholds, 0, m_nrcolumns * sizeof(peak));
 
-  m_scopebufsize = m_nrcolumns * 2;
+  m_columnstate = new column[m_nrcolumns];
+
+  //by default search over one screen width
+  if (m_scopesearch <= 0)
+    m_scopesearch = m_nrcolumns;
+
+  m_scopebufsize = m_nrcolumns + m_scopesearch;
   m_scopebuf = new float[m_scopebufsize];
   memset(m_scopebuf, 0, m_scopebufsize * sizeof(float));
 
+  m_scopelinbuf = new float[m_scopebufsize];
+  m_scopecorrelator.Allocate(m_nrcolumns, m_scopesearch);
+
+  //all fft plans are made now, measuring better ones can start without blocking anything here
+  Cfft::StartPlanner();
+
   m_scopedisplaybuf = new float[m_nrcolumns];
   memset(m_scopedisplaybuf, 0, m_nrcolumns * sizeof(float));
 
@@ -185,16 +414,45 @@ void CBitVis::Setup()
   int error;
   m_srcstate = src_new(SRC_SINC_FASTEST, 1, &error);
 
+  m_textbuf = new uint8_t[m_tiler.RowBytes() * m_fontheight];
+  BuildTitleStrip("");
+
+  if (!m_addresses.empty())
+  {
+    m_connections = new CPanelConnection[m_addresses.size()];
+    for (size_t i = 0; i < m_addresses.size(); i++)
+      m_connections[i].Setup(&m_eventloop, m_addresses[i], m_ports[i], m_tiler.PanelColumns(), m_tiler.PanelLines());
+  }
+
+  m_debugencoder.SetSize(m_nrcolumns, m_nrlines);
+
+  for (int i = 0; i < MAXSNAPSHOTS; i++)
+  {
+    m_snapshots[i].spectrum.resize(m_nrcolumns);
+    m_snapshots[i].scope.resize(m_nrcolumns);
+  }
+  m_rendersnapshot.spectrum.resize(m_nrcolumns);
+  m_rendersnapshot.scope.resize(m_nrcolumns);
+
+  m_iovecs.resize(m_tiler.PanelIovecs());
+
+  //frames hold the framebuffer, or a whole frame with the ":00" header and 10 zero bytes for the debug window
+  m_framepool.SetFrameSize(3 + m_tiler.RowBytes() * m_nrlines + 10);
+
   if (m_debug)
     m_debugwindow.Enable(m_nrcolumns, m_nrlines, m_debugscale);
 
   if (m_mpdaddress)
   {
     m_mpdclient = new CMpdClient(m_mpdaddress, m_mpdport);
-    m_mpdclient->StartThread();
+    m_mpdclient->Setup(&m_eventloop);
   }
 
   StartThread();
+
+  //in benchmark mode, frames are rendered synchronously to measure the whole pipeline
+  if (!m_benchmark)
+    m_renderthread.StartThread();
 }
 
 void CBitVis::SetupSignals()
@@ -220,7 +478,13 @@ void CBitVis::SetupSignals()
     return;
   }
 
-  //create a file descriptor that will catch SIGTERM and SIGINT
+  if (sigaddset(&sigset, SIGUSR1) == -1)
+  {
+    LogError("adding SIGUSR1: %s", GetErrno().c_str());
+    return;
+  }
+
+  //create a file descriptor that will catch SIGTERM, SIGINT and SIGUSR1
   m_signalfd = signalfd(-1, &sigset, SFD_NONBLOCK);
   if (m_signalfd == -1)
   {
@@ -228,7 +492,7 @@ void CBitVis::SetupSignals()
   }
   else
   {
-    //block SIGTERM and SIGINT
+    //block SIGTERM, SIGINT and SIGUSR1
     if (sigprocmask(SIG_BLOCK, &sigset, NULL) == -1)
       LogError("sigpocmask: %s", GetErrno().c_str());
   }
@@ -254,61 +518,75 @@ void CBitVis::Run()
 {
   int64_t lastconnect = GetTimeUs() - CONNECTINTERVAL - 1;
 
+  //without an input file, benchmark mode only measures the fft kernels
+  if (m_benchmark)
+  {
+    Cfft::Benchmark();
+    CMultiResFft::Benchmark();
+    BenchmarkScopeResampler();
+    BenchmarkRenderer();
+    BenchmarkTitle();
+
+    if (!CMpdParser::SelfCheck())
+    {
+      LogError("mpd parser self check failed");
+      exit(1);
+    }
+    CMpdParser::Benchmark();
+    if (!m_inputfile)
+      m_stop = true;
+  }
+
   while (!m_stop)
   {
     bool didconnect = false;
 
-    if (m_jackclient.ExitStatus())
+    if (m_audiosource->ExitStatus())
     {
-      LogError("Jack client exited with code %i reason: \"%s\"",
-               (int)m_jackclient.ExitStatus(), m_jackclient.ExitReason().c_str());
-      m_jackclient.Disconnect();
+      LogError("Audio source exited with code %i reason: \"%s\"",
+               m_audiosource->ExitStatus(), m_audiosource->ExitReason().c_str());
+      m_audiosource->Disconnect();
     }
 
-    if (!m_jackclient.IsConnected() && GetTimeUs() - lastconnect > CONNECTINTERVAL)
+    if (m_audiosource->Finished())
     {
-      m_jackclient.Connect();
-      didconnect = true;
+      Log("Audio source finished, exiting");
+      break;
     }
 
-    uint8_t msg;
-    while ((msg = m_jackclient.GetMessage()) != MsgNone)
-      LogDebug("got message %s from jack client", MsgToString(msg));
-
-    if (!m_socket.IsOpen() && m_address && GetTimeUs() - lastconnect > CONNECTINTERVAL)
+    if (!m_audiosource->IsConnected() && GetTimeUs() - lastconnect > CONNECTINTERVAL)
     {
-      CLock lock(m_socketlock);
-      if (m_socket.Open(m_address, m_port, 10000000) != SUCCESS)
-      {
-        LogError("Failed to connect: %s", m_socket.GetError().c_str());
-        m_socket.Close();
-      }
-      else
-      {
-        Log("Connected");
-      }
+      m_audiosource->Connect();
       didconnect = true;
     }
 
+    uint8_t msg;
+    while ((msg = m_audiosource->GetMessage()) != MsgNone)
+      LogDebug("got message %s from audio source", MsgToString(msg));
+
     if (didconnect)
       lastconnect = GetTimeUs();
 
-    if (m_jackclient.IsConnected())
+    if (m_audiosource->IsConnected())
       ProcessAudio();
-    else
+    else if (!m_audiosource->Finished())
       sleep(1);
 
+    CheckOverruns();
     ProcessSignalfd();
   }
 
-  m_jackclient.Disconnect();
+  m_audiosource->Disconnect();
 
-  if (m_mpdclient)
-  {
-    m_mpdclient->StopThread();
-    delete m_mpdclient;
-    m_mpdclient = NULL;
-  }
+  if (m_benchmark && m_inputfile)
+    LogBenchmark();
+
+  //the render thread uses the mpd client
+  m_renderthread.AsyncStopThread();
+  m_snapshotcondition.Lock();
+  m_snapshotcondition.Signal();
+  m_snapshotcondition.Unlock();
+  m_renderthread.StopThread();
 }
 
 void CBitVis::Process()
@@ -332,45 +610,172 @@ void CBitVis::Process()
     LogError("pthread_getschedparam: %s", strerror(returnv));
   }
 
-  int64_t smoothtime = 0;
+  //the panel connections and the mpd client are driven from this thread, by m_eventloop
+  for (size_t i = 0; i < m_addresses.size(); i++)
+    m_connections[i].Start();
+
+  if (m_mpdclient)
+    m_mpdclient->Start();
+
+  int64_t statstime = GetTimeUs();
+  int64_t pacingtime = GetTimeUs();
 
   while (!CThread::m_stop)
   {
-    CLock lock(m_condition);
-    while (!CThread::m_stop && m_data.empty())
-      m_condition.Wait();
+    if (m_logpacing || GetTimeUs() - pacingtime >= PACINGSTATSINTERVAL)
+    {
+      LogPacing();
+      m_logpacing = false;
+      pacingtime = GetTimeUs();
+    }
 
-    if (m_data.empty())
+    CLock lock(m_condition);
+    if (m_frameread == m_framewrite)
+    {
+      //handle the connections until the render thread wakes up the event loop with a new frame
+      lock.Leave();
+      if (!m_eventloop.RunOnce(-1))
+        USleep(100000);
       continue;
+    }
 
-    int64_t  time = m_data.front().first;
-    CTcpData data = m_data.front().second;
-    m_data.pop_front();
+    int64_t time      = m_frames[m_frameread % MAXFRAMES].time;
+    int64_t audiotime = m_frames[m_frameread % MAXFRAMES].audiotime;
+    CFrame* frame     = m_frames[m_frameread % MAXFRAMES].frame;
+    int64_t depth     = m_framewrite - m_frameread;
+    m_frameread++;
+    m_condition.Signal();
     lock.Leave();
 
-    if (smoothtime == 0)
+    m_queuedframes += depth;
+    m_maxqueuedepth = Max(m_maxqueuedepth, depth);
+
+    //when the sender fell behind, skip frames that missed their deadline by more than a frame
+    //so the display catches up with the audio, the newest frame is always sent
+    if (depth > 1 && GetTimeUs() - time > 1000000 / m_fps)
     {
-      //init smoothtime first with a timestamp
-      smoothtime = time;
+      m_staleframes++;
+      frame->Release();
+      continue;
     }
-    else
+
+    //the timestamps come from the sample clock of the audio source, so they're used as deadlines as is,
+    //time spent rendering and sending doesn't delay the next frame
+    if (GetTimeUs() > time)
+      m_lateframes++;
+
+    RunEventLoop(time);
+
+    m_jitter.Add(GetTimeUs() - time);
+    m_pacedframes++;
+
+    //the panel frames are written straight from the framebuffer
+    //a panel that is still busy with the previous frame skips this one
+    const uint8_t* framebuf = (const uint8_t*)frame->Data().GetData();
+    const int      rowbytes = m_tiler.RowBytes();
+
+    for (size_t i = 0; i < m_addresses.size(); i++)
     {
-      //filter out timing jitter
-      smoothtime += 1000000 / m_fps;
-      smoothtime += (time - smoothtime) / 100;
+      CPanelConnection& connection = m_connections[i];
+      if (!connection.CanSend())
+        continue;
+
+      if (m_delta && connection.Encoder().EncodeRows(m_tiler.PanelRows(framebuf, i), rowbytes))
+      {
+        connection.Send(connection.Encoder().Delta());
+      }
+      else
+      {
+        int iovcnt = m_tiler.MakePanelIovecs(framebuf, i, &m_iovecs[0]);
+        connection.Send(&m_iovecs[0], iovcnt);
+      }
     }
 
-    USleep(smoothtime - GetTimeUs());
+    m_wirelatency.Add(GetTimeUs() - audiotime);
+
+    if (m_staleframes != m_stalereported && GetTimeUs() - m_staletime >= 1000000)
+    {
+      LogError("Sender dropped %" PRIi64 " stale frames, %" PRIi64 " in total",
+               m_staleframes - m_stalereported, m_staleframes);
+      m_stalereported = m_staleframes;
+      m_staletime = GetTimeUs();
+    }
 
-    CLock socketlock(m_socketlock);
-    if (m_socket.IsOpen() && m_socket.Write(data) != SUCCESS)
+    if (GetTimeUs() - statstime >= WRITESTATSINTERVAL)
     {
-      LogError("%s", m_socket.GetError().c_str());
-      m_socket.Close();
+      LogWriteStats();
+      statstime = GetTimeUs();
     }
-    socketlock.Leave();
 
-    m_debugwindow.DisplayFrame(data);
+    if (m_debug)
+    {
+      if (m_delta && m_debugencoder.EncodeRows(framebuf, rowbytes))
+      {
+        m_debugwindow.DisplayFrame(m_debugencoder.Delta());
+      }
+      else
+      {
+        CFrame* full = m_framepool.GetFrame();
+        m_tiler.MakeFrame(framebuf, full->Data());
+        m_debugwindow.DisplayFrame(full);
+        full->Release();
+      }
+    }
+
+    frame->Release();
+  }
+
+  for (size_t i = 0; i < m_addresses.size(); i++)
+    m_connections[i].Stop();
+
+  if (m_mpdclient)
+    m_mpdclient->Stop();
+}
+
+//handles the panel connections until the absolute time until,
+//epoll only has millisecond precision, so the last part is slept, and optionally busy waited
+void CBitVis::RunEventLoop(int64_t until)
+{
+  int64_t now;
+  while (!CThread::m_stop && (now = GetTimeUs()) < until - m_spintime - 1000)
+  {
+    if (!m_eventloop.RunOnce((until - m_spintime - now) / 1000 * 1000))
+      break;
+  }
+
+  USleepUntil(until, m_spintime);
+}
+
+void CBitVis::LogPacing()
+{
+  if (m_pacedframes == 0)
+    return;
+
+  Log("Pacing: %" PRIi64 " frames, %" PRIi64 " queued late, %" PRIi64 " stale, lateness %s",
+      m_pacedframes, m_lateframes, m_staleframes, m_jitter.ToString().c_str());
+  Log("Queue depth average %.2f max %" PRIi64 ", audio to wire latency %s",
+      (double)m_queuedframes / (m_pacedframes + m_staleframes), m_maxqueuedepth,
+      m_wirelatency.ToString().c_str());
+}
+
+//logs the write latency and health of every panel connection, called from the sender thread
+void CBitVis::LogWriteStats()
+{
+  for (size_t i = 0; i < m_addresses.size(); i++)
+  {
+    int64_t writes, totaltime, maxtime;
+    m_connections[i].Socket().GetWriteStats(writes, totaltime, maxtime);
+    m_connections[i].Socket().ResetWriteStats();
+
+    if (writes > 0)
+      LogDebug("%s:%i: %" PRIi64 " writes, average %" PRIi64 " us, max %" PRIi64 " us",
+               m_addresses[i].c_str(), m_ports[i], writes, totaltime / writes, maxtime);
+
+    CPanelConnection& connection = m_connections[i];
+    if (!connection.IsConnected())
+      Log("%s:%i: %s for %" PRIi64 " seconds, %i failed attempts",
+          m_addresses[i].c_str(), m_ports[i], connection.StateToString(),
+          (GetTimeUs() - connection.StateTime()) / 1000000, connection.Failures());
   }
 }
 
@@ -394,6 +799,12 @@ void CBitVis::ProcessSignalfd()
       Log("caught %s, exiting", siginfo.ssi_signo == SIGTERM ? "SIGTERM" : "SIGINT");
       m_stop = true;
     }
+    else if (siginfo.ssi_signo == SIGUSR1)
+    {
+      //the pacing statistics are owned by the sender thread
+      m_logpacing = true;
+      m_eventloop.Wakeup();
+    }
     else
     {
       LogDebug("caught signal %i", siginfo.ssi_signo);
@@ -406,174 +817,450 @@ void CBitVis::ProcessAudio()
   int samplerate;
   int samples;
   int64_t audiotime;
-  if ((samples = m_jackclient.GetAudio(m_buf, m_bufsize, samplerate, audiotime)) > 0)
+  if ((samples = m_audiosource->GetAudio(m_buf, samplerate, audiotime)) > 0)
   {
-    int additions = 0;
-    for (int i = 1; i < m_nrcolumns; i++)
-      additions += i;
+    int64_t cpustart = m_benchmark ? GetThreadCpuTimeUs() : 0;
 
-    const int maxbin = Round32(15000.0f / samplerate * m_nrbins * 2.0f);
+    //only rebuilds the table when something changed
+    if (m_multiresstages > 0)
+      m_multires.Build(samplerate, m_nrbins * 2, m_nrcolumns, m_scale);
+    else
+      m_binmap.Build(samplerate, m_fft.m_bufsize, m_nrcolumns, m_scale);
 
-    float increase = (float)(maxbin - m_nrcolumns - 1) / additions;
+    //process the audio in blocks that end at a display frame boundary
+    const int framesize = Max(samplerate / m_fps, 1);
+    if (m_samplecounter >= framesize)
+      m_samplecounter = 0;
 
-    for (int i = 0; i < samples; i++)
+    int blockstart = 0;
+    while (blockstart < samples)
     {
-      m_fft.AddSample(m_buf[i]);
-      m_samplecounter++;
+      int blockend = Min(samples, blockstart + framesize - m_samplecounter);
 
-      const float hys = 0.01;
-      if (m_hysstate == -1)
-      {
-        if (m_buf[i] < -hys)
-          m_hysstate = 1;
-      }
-      else if (m_hysstate == 1)
+      if (m_multiresstages > 0)
+        m_multires.AddSamples(m_buf + blockstart, blockend - blockstart);
+      else
+        m_fft.AddSamples(m_buf + blockstart, blockend - blockstart);
+      m_samplecounter += blockend - blockstart;
+
+      for (int i = blockstart; i < blockend; i++)
       {
-        if (m_buf[i] > hys)
+        const float hys = 0.01;
+        if (m_hysstate == -1)
         {
-          m_hysstate = 0;
-          m_hystime = audiotime;
-          m_hasaudio = true;
+          if (m_buf[i] < -hys)
+            m_hysstate = 1;
+        }
+        else if (m_hysstate == 1)
+        {
+          if (m_buf[i] > hys)
+          {
+            m_hysstate = 0;
+            m_hystime = audiotime;
+            m_hasaudio = true;
+          }
         }
       }
 
-      SRC_DATA srcdata = {};
-      srcdata.data_in = m_buf + i;
-      srcdata.data_out = m_scopebuf + m_scopebufpos;
-      srcdata.input_frames = 1;
-      srcdata.output_frames = 1;
-      srcdata.src_ratio = (double)m_nrcolumns * 30.0 / samplerate;
+      ResampleScope(m_buf + blockstart, blockend - blockstart, samplerate);
 
-      src_process(m_srcstate, &srcdata);
+      blockstart = blockend;
 
-      if (srcdata.output_frames_gen)
-      {
-        m_scopebufpos++;
+      if (m_samplecounter < framesize)
+        continue;
 
-        if (m_scopebufpos == m_scopebufsize)
-          m_scopebufpos = 0;
-      }
+      m_samplecounter = 0;
+      m_hysstate = -1;
 
-      if (m_samplecounter % (samplerate / 4 / m_fps) == 0)
+      //when the hop is longer than a display frame, there might not be a new fft yet
+      const float* columns = NULL;
+      if (m_multiresstages > 0)
       {
-        m_fft.ApplyWindow();
-        fftwf_execute(m_fft.m_plan);
+        columns = m_multires.Apply();
+      }
+      else if (m_fft.m_nrframes > 0)
+      {
+        columns = m_binmap.Apply(m_fft.m_magnitudes, 1.0f / m_fft.m_nrframes);
+        m_fft.ResetMagnitudes();
+      }
 
-        m_nrffts++;
-        for (int j = 0; j < m_nrbins; j++)
-        {
-          std::complex<float> bin;
-          memcpy(&bin, m_fft.m_outbuf[j], sizeof(bin));
-          m_fftbuf[j] += std::abs(bin) / m_fft.m_bufsize;
-        }
+      if (columns)
+      {
+        for (int j = 0; j < m_nrcolumns; j++)
+          m_displaybuf[j] = m_displaybuf[j] * m_decay + columns[j] * (1.0f - m_decay);
       }
 
-      if (m_samplecounter % (samplerate / m_fps) == 0)
+      //unwrap the scope ring buffer, starting at the oldest sample
+      int tail = m_scopebufsize - m_scopebufpos;
+      memcpy(m_scopelinbuf, m_scopebuf + m_scopebufpos, tail * sizeof(float));
+      memcpy(m_scopelinbuf + tail, m_scopebuf, m_scopebufpos * sizeof(float));
+
+      int offset = m_scopecorrelator.FindOffset(m_scopedisplaybuf, m_scopelinbuf);
+      memcpy(m_scopecorrbuf, m_scopelinbuf + offset, m_nrcolumns * sizeof(float));
+
+      const float interpolant = 0.5;
+      for (int j = 0; j < m_nrcolumns; j++)
+        m_scopedisplaybuf[j] = m_scopedisplaybuf[j] * (1.0 - interpolant) + m_scopecorrbuf[j] * interpolant;
+
+      if (m_hasaudio && audiotime - m_hystime > 5000000)
       {
-        m_hysstate = -1;
+        memset(m_scopedisplaybuf, 0, m_nrcolumns * sizeof(float));
+        m_hasaudio = false;
+      }
 
-        float start = 0.0f;
-        float add = 1.0f;
-        for (int j = 0; j < m_nrcolumns; j++)
-        {
-          float next = start + add;
+      QueueSnapshot(audiotime + Round64(1000000.0 / (double)samplerate * (double)(blockend - 1)));
+    }
+
+    if (m_benchmark)
+      m_benchcputime += GetThreadCpuTimeUs() - cpustart;
+  }
+}
 
-          int bin    = Round32(start) + 1;
-          int nrbins = Round32(next - start);
-          float outval = 0.0f;
-          for (int k = bin; k < bin + nrbins; k++)
-            outval += m_fftbuf[k] / m_nrffts;
+//log when the audio source dropped blocks, at most once per second
+void CBitVis::CheckOverruns()
+{
+  int64_t overruns = m_audiosource->Overruns();
+  if (overruns != m_overruns && GetTimeUs() - m_overruntime >= 1000000)
+  {
+    LogError("Audio source dropped %" PRIi64 " blocks, %" PRIi64 " in total",
+             overruns - m_overruns, overruns);
+    m_overruns = overruns;
+    m_overruntime = GetTimeUs();
+  }
 
-          m_displaybuf[j] = m_displaybuf[j] * m_decay + outval * (1.0f - m_decay);
+  CLock lock(m_snapshotcondition);
+  int64_t dropped = m_droppedsnapshots;
+  lock.Leave();
 
-          start = next;
-          add += increase;
-        }
+  if (dropped != m_droppedreported && GetTimeUs() - m_droppedtime >= 1000000)
+  {
+    LogError("Render stage dropped %" PRIi64 " frames, %" PRIi64 " in total",
+             dropped - m_droppedreported, dropped);
+    m_droppedreported = dropped;
+    m_droppedtime = GetTimeUs();
+  }
+}
 
-        int offset = 0;
-        float maxweight = 0.0;
-        for (int j = 0; j < m_scopebufsize - m_nrcolumns; j++)
-        {
-          float weight = 0.0f;
-          for (int k = 0; k < m_nrcolumns; k++)
-          {
-            int pos = m_scopebufpos + j + k;
-            if (pos >= m_scopebufsize)
-              pos -= m_scopebufsize;
+//hands the current spectrum and scope to the render stage
+//when the render stage falls behind, the oldest snapshot is dropped
+void CBitVis::QueueSnapshot(int64_t time)
+{
+  if (m_benchmark)
+  {
+    m_rendersnapshot.time = time;
+    m_rendersnapshot.hasaudio = m_hasaudio;
+    memcpy(&m_rendersnapshot.spectrum[0], m_displaybuf, m_nrcolumns * sizeof(float));
+    memcpy(&m_rendersnapshot.scope[0], m_scopedisplaybuf, m_nrcolumns * sizeof(float));
+    SendData(m_rendersnapshot);
+    return;
+  }
 
-            weight += m_scopedisplaybuf[k] * m_scopebuf[pos];
-          }
+  CLock lock(m_snapshotcondition);
+  if (m_snapshotwrite - m_snapshotread == MAXSNAPSHOTS)
+  {
+    m_snapshotread++;
+    m_droppedsnapshots++;
+  }
 
-          if (weight > maxweight)
-          {
-            maxweight = weight;
-            offset = j;
-          }
-        }
+  snapshot& snap = m_snapshots[m_snapshotwrite % MAXSNAPSHOTS];
+  snap.time = time;
+  snap.hasaudio = m_hasaudio;
+  memcpy(&snap.spectrum[0], m_displaybuf, m_nrcolumns * sizeof(float));
+  memcpy(&snap.scope[0], m_scopedisplaybuf, m_nrcolumns * sizeof(float));
+  m_snapshotwrite++;
 
-        int pos = m_scopebufpos + offset;
-        if (pos >= m_scopebufsize)
-          pos -= m_scopebufsize;
+  m_snapshotcondition.Signal();
+}
 
-        int size;
-        if (m_scopebufsize - pos < m_nrcolumns)
-          size = m_scopebufsize - pos;
-        else
-          size = m_nrcolumns;
+//called from the render thread, renders the oldest queued snapshot
+void CBitVis::ProcessRender()
+{
+  CLock lock(m_snapshotcondition);
+  if (m_snapshotread == m_snapshotwrite)
+    m_snapshotcondition.Wait(100000);
 
-        memcpy(m_scopecorrbuf, m_scopebuf + pos, size * sizeof(float));
-        if (size < m_nrcolumns)
-          memcpy(m_scopecorrbuf + size, m_scopebuf, (m_nrcolumns - size) * sizeof(float));
+  if (m_snapshotread == m_snapshotwrite)
+    return;
 
-        const float interpolant = 0.5;
-        for (int j = 0; j < m_nrcolumns; j++)
-          m_scopedisplaybuf[j] = m_scopedisplaybuf[j] * (1.0 - interpolant) + m_scopecorrbuf[j] * interpolant;
+  //swap the buffers instead of copying, they all have the same size
+  snapshot& snap = m_snapshots[m_snapshotread % MAXSNAPSHOTS];
+  m_rendersnapshot.time = snap.time;
+  m_rendersnapshot.hasaudio = snap.hasaudio;
+  m_rendersnapshot.spectrum.swap(snap.spectrum);
+  m_rendersnapshot.scope.swap(snap.scope);
+  m_snapshotread++;
+  lock.Leave();
 
-        if (m_hasaudio && audiotime - m_hystime > 5000000)
-        {
-          memset(m_scopedisplaybuf, 0, m_nrcolumns * sizeof(float));
-          m_hasaudio = false;
-        }
+  SendData(m_rendersnapshot);
+}
+
+//resamples a block of audio to the scope rate, and writes it into the scope ring buffer
+void CBitVis::ResampleScope(float* in, int nrsamples, int samplerate)
+{
+  SRC_DATA srcdata = {};
+  srcdata.data_in = in;
+  srcdata.input_frames = nrsamples;
+  srcdata.src_ratio = (double)m_nrcolumns * 30.0 / samplerate;
+
+  while (srcdata.input_frames > 0)
+  {
+    srcdata.data_out = m_scoperesamplebuf;
+    srcdata.output_frames = sizeof(m_scoperesamplebuf) / sizeof(m_scoperesamplebuf[0]);
+
+    src_process(m_srcstate, &srcdata);
+
+    float* out = m_scoperesamplebuf;
+    int    outsamples = srcdata.output_frames_gen;
+    while (outsamples > 0)
+    {
+      int size = Min(outsamples, m_scopebufsize - m_scopebufpos);
+      memcpy(m_scopebuf + m_scopebufpos, out, size * sizeof(float));
+
+      out += size;
+      outsamples -= size;
+      m_scopebufpos += size;
+      if (m_scopebufpos == m_scopebufsize)
+        m_scopebufpos = 0;
+    }
+
+    if (srcdata.input_frames_used == 0 && srcdata.output_frames_gen == 0)
+      break;
+
+    srcdata.data_in += srcdata.input_frames_used;
+    srcdata.input_frames -= srcdata.input_frames_used;
+  }
+}
+
+//logs the cpu cost of resampling one second of audio for the scope,
+//one sample per src_process call versus whole blocks
+void CBitVis::BenchmarkScopeResampler()
+{
+  const int samplerate = 40000;
+  const int seconds = 10;
+  std::vector<float> samples(samplerate);
+  for (size_t i = 0; i < samples.size(); i++)
+    samples[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+
+  int error;
+  SRC_STATE* srcstate = src_new(SRC_SINC_FASTEST, 1, &error);
+  float      out;
+
+  int64_t start = GetThreadCpuTimeUs();
+  for (int i = 0; i < seconds; i++)
+  {
+    for (int j = 0; j < samplerate; j++)
+    {
+      SRC_DATA srcdata = {};
+      srcdata.data_in = &samples[j];
+      srcdata.data_out = &out;
+      srcdata.input_frames = 1;
+      srcdata.output_frames = 1;
+      srcdata.src_ratio = (double)m_nrcolumns * 30.0 / samplerate;
+      src_process(srcstate, &srcdata);
+    }
+  }
+  int64_t persample = GetThreadCpuTimeUs() - start;
+  src_delete(srcstate);
 
-        SendData(audiotime + Round64(1000000.0 / (double)samplerate * (double)i));
+  //use the real resampler state and scope buffer, and clear them afterwards
+  start = GetThreadCpuTimeUs();
+  for (int i = 0; i < seconds; i++)
+  {
+    for (int j = 0; j < samplerate; j += 1024)
+      ResampleScope(&samples[j], Min(1024, samplerate - j), samplerate);
+  }
+  int64_t perblock = GetThreadCpuTimeUs() - start;
+
+  src_reset(m_srcstate);
+  memset(m_scopebuf, 0, m_scopebufsize * sizeof(float));
+  m_scopebufpos = 0;
+
+  Log("Benchmark: scope resampler per sample: %.0f us, per block: %.0f us, per second of audio",
+      (double)persample / seconds, (double)perblock / seconds);
+}
+
+//renders the spectrum, peaks and scope below the text
+//the first pass computes everything that only depends on the column,
+//the second pass fills the rows from that, 16 pixels at a time
+void CBitVis::RenderSpectrum(const snapshot& snap, int nrlines, bool drawbar, int elapsed)
+{
+  const float mul = 0.25f;
+  const float add = 0.75f;
+
+  for (int x = 0; x < m_nrcolumns; x++)
+  {
+    column& col = m_columnstate[x];
+
+    if (snap.spectrum[x] > 0.0f)
+      col.bar = Round32(((log10f(snap.spectrum[x]) * 20.0f) + 55.0f) / 48.0f * nrlines);
+    else
+      col.bar = -1;
+
+    peak& currpeak = m_peakholds[x];
+    if (col.bar >= Round32(currpeak.value))
+    {
+      currpeak.value = col.bar;
+      currpeak.time = snap.time;
+    }
+    col.peak = Round32(currpeak.value);
+
+    if (snap.hasaudio)
+    {
+      //the scope line goes from halfway the previous column to halfway the next one
+      float curr = (snap.scope[x] * m_scopemul * mul + add) * nrlines;
+      float prev = x == 0 ? curr : (snap.scope[x - 1] * m_scopemul * mul + add) * nrlines;
+      float next = x == m_nrcolumns - 1 ? curr : (snap.scope[x + 1] * m_scopemul * mul + add) * nrlines;
+
+      int bound1 = Round32((prev + curr) * 0.5f) - 1;
+      int bound2 = Round32((next + curr) * 0.5f) - 1;
+      col.scopelow = Min(bound1, bound2);
+      col.scopehigh = Max(bound1, bound2);
+    }
+    else
+    {
+      col.scopelow = 1;
+      col.scopehigh = 0;
+    }
+  }
+
+  const int rowbytes = m_tiler.RowBytes();
+  for (int y = nrlines - 1; y >= 0; y--)
+  {
+    uint8_t* line = m_framebuf + (nrlines - 1 - y) * rowbytes;
+    int      x = 0;
+    while (x < m_nrcolumns)
+    {
+      //the leftmost pixel goes in the highest bits, columns are always a multiple of 4
+      int      nrpixels = Min(16, m_nrcolumns - x);
+      uint32_t word = 0;
+      for (int i = 0; i < nrpixels; i++)
+      {
+        const column& col = m_columnstate[x + i];
+        uint32_t pixel;
+        if (y == 0)
+          pixel = drawbar ? (x + i < elapsed ? 3 : 2) : 0;
+        else if (col.peak == y)
+          pixel = 2;
+        else if (col.bar > y)
+          pixel = 1;
+        else if (y >= col.scopelow && y <= col.scopehigh)
+          pixel = 3;
+        else
+          pixel = 0;
 
-        memset(m_fftbuf, 0, m_nrbins * sizeof(float));
-        m_nrffts = 0;
+        word = (word << 2) | pixel;
       }
+
+      for (int i = nrpixels / 4 - 1; i >= 0; i--)
+      {
+        line[x / 4 + i] = word & 0xFF;
+        word >>= 8;
+      }
+
+      x += nrpixels;
     }
   }
 }
 
+//renders frames from a synthetic spectrum and scope, the peak holds are reset afterwards
+void CBitVis::BenchmarkRenderer()
+{
+  const int nrframes = 10000;
+
+  snapshot snap;
+  snap.hasaudio = true;
+  snap.spectrum.resize(m_nrcolumns);
+  snap.scope.resize(m_nrcolumns);
+  for (int i = 0; i < m_nrcolumns; i++)
+  {
+    snap.spectrum[i] = (float)rand() / RAND_MAX * 0.1f;
+    snap.scope[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+  }
+
+  CFrame* frame = m_framepool.GetFrame();
+  frame->Data().Resize(m_tiler.RowBytes() * m_nrlines);
+  m_framebuf = (uint8_t*)frame->Data().GetData();
+
+  int64_t start = GetThreadCpuTimeUs();
+  for (int i = 0; i < nrframes; i++)
+  {
+    snap.time = (int64_t)i * 1000000 / 30;
+    RenderSpectrum(snap, m_nrlines, true, m_nrcolumns / 2);
+  }
+  int64_t rendertime = GetThreadCpuTimeUs() - start;
+
+  frame->Release();
+  m_framebuf = NULL;
+  memset(m_peakholds, 0, m_nrcolumns * sizeof(peak));
+
+  Log("Benchmark: rendering %ix%i: %.2f us per frame",
+      m_nrcolumns, m_nrlines, (double)rendertime / nrframes);
+}
+
 void CBitVis::Cleanup()
 {
-  m_condition.Lock();
+  m_renderthread.AsyncStopThread();
+  m_snapshotcondition.Lock();
+  m_snapshotcondition.Signal();
+  m_snapshotcondition.Unlock();
+  m_renderthread.StopThread();
+
   AsyncStopThread();
-  m_condition.Signal();
-  m_condition.Unlock();
+  m_eventloop.Wakeup();
 
-  m_jackclient.Disconnect();
+  if (m_audiosource)
+    m_audiosource->Disconnect();
   m_debugwindow.Disable();
   StopThread();
+
+  //the sender thread drove the mpd client, and the render thread read from it
+  delete m_mpdclient;
+  m_mpdclient = NULL;
 }
 
-void CBitVis::SendData(int64_t time)
+//runs in the render thread, or in the main thread in benchmark mode
+void CBitVis::SendData(const snapshot& snap)
 {
-  CTcpData data;
-  data.SetData(":00");
-
+  const int64_t time = snap.time;
+  const int rowbytes = m_tiler.RowBytes();
   int nrlines;
-  bool playingchanged;
+  bool playingchanged = false;
+
+  //render straight into the buffer that the sender thread writes to the sockets
+  CFrame* frame = m_framepool.GetFrame();
+  frame->Data().Resize(rowbytes * m_nrlines);
+  m_framebuf = (uint8_t*)frame->Data().GetData();
+
   bool isplaying = false;
   int  volume = 0;
   int elapsed = 0;
+  bool songchanged = false;
   if (m_mpdclient)
   {
-    isplaying = m_mpdclient->IsPlaying(playingchanged);
-    if (m_mpdclient->GetVolume(volume))
+    CMpdClient::state mpdstate;
+    m_mpdclient->GetState(mpdstate);
+
+    isplaying = mpdstate.isplaying;
+    volume = mpdstate.volume;
+
+    playingchanged = mpdstate.playingversion != m_mpdplayingversion;
+    m_mpdplayingversion = mpdstate.playingversion;
+
+    if (mpdstate.volumeversion != m_mpdvolumeversion)
+    {
+      m_mpdvolumeversion = mpdstate.volumeversion;
       m_volumetime = GetTimeUs();
+    }
+
+    //the song text is only copied when it changed
+    if (mpdstate.songversion != m_mpdsongversion)
+    {
+      m_mpdsongversion = m_mpdclient->CurrentSong(m_currentsong);
+      songchanged = true;
+    }
 
     if (isplaying)
-      elapsed = Round32(m_mpdclient->GetElapsedState() * m_nrcolumns);
+      elapsed = Round32(CMpdClient::ElapsedState(mpdstate) * m_nrcolumns);
   }
 
   if (isplaying)
@@ -595,8 +1282,8 @@ void CBitVis::SendData(int64_t time)
   {
     for (int y = 0; y < nrlines; y++)
     {
-      uint8_t line[m_nrcolumns / 4];
-      memset(line, 0, sizeof(line));
+      uint8_t* line = m_framebuf + y * rowbytes;
+      memset(line, 0, rowbytes);
       int pixelcounter = 3;
       for (int x = 0; x < m_nrcolumns; x++)
       {
@@ -619,7 +1306,6 @@ void CBitVis::SendData(int64_t time)
         if (pixelcounter == -1)
           pixelcounter = 3;
       }
-      data.SetData(line, sizeof(line), true);
     }
   }
   else
@@ -627,8 +1313,8 @@ void CBitVis::SendData(int64_t time)
     float scopemax = 0.0f;
     for (int i = 0; i < m_nrcolumns; i++)
     {
-      if (fabs(m_scopedisplaybuf[i]) > scopemax)
-        scopemax = fabs(m_scopedisplaybuf[i]);
+      if (fabs(snap.scope[i]) > scopemax)
+        scopemax = fabs(snap.scope[i]);
     }
 
     float scopemul;
@@ -642,73 +1328,10 @@ void CBitVis::SendData(int64_t time)
     else
       m_scopemul = m_scopemul * 0.9 + scopemul * 0.1;
 
-    for (int y = nrlines - 1; y >= 0; y--)
-    {
-      uint8_t line[m_nrcolumns / 4];
-      for (int x = 0; x < m_nrcolumns / 4; x++)
-      {
-        uint8_t pixel = 0;
-        for (int i = 0; i < 4; i++)
-        {
-          int pixelpos = x * 4 + i;
-          int value = Round32(((log10(m_displaybuf[pixelpos]) * 20.0f) + 55.0f) / 48.0f * nrlines);
-
-          peak& currpeak = m_peakholds[pixelpos];
-          if (value >= Round32(currpeak.value))
-          {
-            currpeak.value = value;
-            currpeak.time = time;
-          }
-
-          pixel <<= 2;
-
-          float prev;
-          float curr;
-          float next;
-
-          const float mul = 0.25f;
-          const float add = 0.75f;
-
-          curr = (m_scopedisplaybuf[pixelpos] * m_scopemul * mul + add) * nrlines;
-
-          if (pixelpos == 0)
-            prev = curr;
-          else
-            prev = (m_scopedisplaybuf[pixelpos - 1] * m_scopemul * mul + add) * nrlines;
-
-          if (pixelpos == m_nrcolumns - 1)
-            next = curr;
-          else
-            next = (m_scopedisplaybuf[pixelpos + 1] * m_scopemul * mul + add) * nrlines;
-
-          int bounds[2] = {Round32((prev + curr) * 0.5f) - 1, Round32((next + curr) * 0.5f) - 1};
-
-          if (y == 0)
-          {
-            if (m_hasaudio || isplaying)
-            {
-              pixel |= 2;
-              if (x * 4 + i < elapsed)
-                pixel |= 1;
-            }
-          }
-          else if (Round32(currpeak.value) == y)
-          {
-            pixel |= 2;
-          }
-          else if (value > y)
-          {
-            pixel |= 1;
-          }
-          else if (m_hasaudio && ((y <= bounds[0] && y >= bounds[1]) || (y >= bounds[0] && y <= bounds[1])))
-          {
-            pixel |= 3;
-          }
-        }
-        line[x] = pixel;
-      }
-      data.SetData(line, sizeof(line), true);
-    }
+    int64_t renderstart = m_benchmark ? GetThreadCpuTimeUs() : 0;
+    RenderSpectrum(snap, nrlines, snap.hasaudio || isplaying, elapsed);
+    if (m_benchmark)
+      m_benchrendertime += GetThreadCpuTimeUs() - renderstart;
 
     for (int i = 0; i < m_nrcolumns; i++)
     {
@@ -731,31 +1354,52 @@ void CBitVis::SendData(int64_t time)
     }
   }
 
-  uint8_t text[m_nrcolumns / 4 * m_fontheight];
-  memset(text, 0, sizeof(text));
+  if (songchanged)
+    BuildTitleStrip(m_currentsong.c_str());
 
-  string currentsong;
-  if ((m_mpdclient && m_mpdclient->CurrentSong(currentsong)) || playingchanged)
+  if (songchanged || playingchanged)
   {
     m_scrolloffset = 0;
     m_songupdatetime = GetTimeUs();
   }
 
-  SetText(text, currentsong.c_str());
+  DrawTitle(m_textbuf);
   if (m_fontdisplay > 0)
-    data.SetData(text, m_nrcolumns / 4 * m_fontdisplay, true);
+    memcpy(m_framebuf + nrlines * rowbytes, m_textbuf, rowbytes * m_fontdisplay);
 
-  uint8_t end[10];
-  memset(end, 0, sizeof(end));
-  data.SetData(end, sizeof(end), true);
+  if (m_benchmark)
+  {
+    //only count the frame, the sender thread would pace it to the audio timestamps
+    m_benchframes++;
+    frame->Release();
+  }
+  else
+  {
+    //wait for room in the queue, when the sender thread falls behind
+    //the render thread blocks, and the analysis stage drops snapshots instead
+    CLock lock(m_condition);
+    while (m_framewrite - m_frameread == MAXFRAMES && !m_renderthread.IsStopping())
+      m_condition.Wait(100000);
 
-  //add 10 milliseconds to the timestamp, since the current timestamp
-  //might already have passed because of processing, this decreases
-  //jitter in the display output
-  CLock lock(m_condition);
-  m_data.push_back(make_pair(time + 10000, data));
-  lock.Leave();
-  m_condition.Signal();
+    if (m_framewrite - m_frameread == MAXFRAMES)
+    {
+      lock.Leave();
+      frame->Release();
+    }
+    else
+    {
+      //the frame is shown when the audio it was made from is heard,
+      //the output latency also leaves time for processing, so the deadline hasn't passed yet
+      m_frames[m_framewrite % MAXFRAMES].time = time + m_outputlatency;
+      m_frames[m_framewrite % MAXFRAMES].audiotime = time;
+      m_frames[m_framewrite % MAXFRAMES].frame = frame;
+      m_framewrite++;
+      lock.Leave();
+      m_eventloop.Wakeup();
+    }
+  }
+
+  m_framebuf = NULL;
 
   if (volume != m_displayvolume)
   {
@@ -768,62 +1412,184 @@ void CBitVis::SendData(int64_t time)
   }
 }
 
-void CBitVis::SetText(uint8_t* buff, const char* str, int offset /*= 0*/)
+void CBitVis::LogBenchmark()
 {
-  int length = strlen(str);
+  if (m_benchframes == 0 || m_benchcputime <= 0)
+  {
+    Log("Benchmark: no frames processed");
+    return;
+  }
+
+  Log("Benchmark: %i frames in %.3f seconds of cpu time, %.1f us per frame, %.1f frames per cpu second",
+      m_benchframes, (double)m_benchcputime / 1000000.0, (double)m_benchcputime / m_benchframes,
+      (double)m_benchframes * 1000000.0 / m_benchcputime);
+  Log("Benchmark: %.2f us per frame spent rendering", (double)m_benchrendertime / m_benchframes);
+  Log("Benchmark: %.3f frame buffer allocations per frame", (double)m_framepool.Allocations() / m_benchframes);
+}
 
-  int charpos = offset + m_scrolloffset;
-  int pixlength = 0;
-  for (int i = 0; i < length; i++)
+//decodes one utf-8 character, and returns the ascii character it's drawn as,
+//latin-1 letters lose their accents, invalid sequences are taken as latin-1 bytes
+static char DecodeUTF8(const char*& str)
+{
+  //letters from U+00C0 to U+00FF without accents
+  static const char latin1[] = "AAAAAAACEEEEIIIIDNOOOOOxOUUUUYPsaaaaaaaceeeeiiiidnooooo/ouuuuypy";
+
+  const uint8_t* in = (const uint8_t*)str;
+  uint32_t codepoint;
+  int      length;
+
+  if (in[0] < 0x80)
   {
-    map<char, vector<unsigned int> >::iterator it = m_glyphs.find(str[i]);
-    vector<unsigned int>& dchar = it->second;
-    if (it != m_glyphs.end())
+    str++;
+    return in[0];
+  }
+  else if ((in[0] & 0xE0) == 0xC0)
+  {
+    codepoint = in[0] & 0x1F;
+    length = 2;
+  }
+  else if ((in[0] & 0xF0) == 0xE0)
+  {
+    codepoint = in[0] & 0x0F;
+    length = 3;
+  }
+  else if ((in[0] & 0xF8) == 0xF0)
+  {
+    codepoint = in[0] & 0x07;
+    length = 4;
+  }
+  else
+  {
+    codepoint = in[0];
+    length = 0;
+  }
+
+  for (int i = 1; i < length; i++)
+  {
+    if ((in[i] & 0xC0) != 0x80)
     {
-      for (size_t j = 0; j < dchar.size(); j++)
-      {
-        if (charpos >= 0 && charpos < m_nrcolumns)
-        {
-          for (int k = 0; k < m_fontheight; k++)
-          {
-            int bit = (dchar[j] >> k) & 1;
-            buff[charpos / 4 + m_nrcolumns / 4 * (m_fontheight - k - 1)] |= bit << (6 - ((charpos % 4) * 2));
-          }
-        }
-        charpos++;
-        pixlength++;
-      }
+      codepoint = in[0];
+      length = 0;
+      break;
+    }
+    codepoint = (codepoint << 6) | (in[i] & 0x3F);
+  }
+
+  str += length > 0 ? length : 1;
+
+  if (codepoint >= 0xC0 && codepoint <= 0xFF)
+    return latin1[codepoint - 0xC0];
+  else
+    return '?';
+}
+
+//renders the text into m_titlestrip, only called when the text changed
+void CBitVis::BuildTitleStrip(const char* str)
+{
+  //first find the width in pixels, with one empty column between glyphs
+  m_titlepixels = 0;
+  for (const char* ptr = str; *ptr;)
+  {
+    char c = DecodeUTF8(ptr);
+    if (m_glyphs[(int)c].width > 0)
+      m_titlepixels += m_glyphs[(int)c].width + 1;
+  }
+  if (m_titlepixels > 0)
+    m_titlepixels--;
+
+  //one extra byte, since a window that isn't byte aligned reads one byte more
+  m_stripbytes = (m_nrcolumns * 2 + m_titlepixels + 3) / 4 + 1;
+  m_titlestrip.assign(m_stripbytes * m_fontheight, 0);
+
+  int x = m_nrcolumns;
+  for (const char* ptr = str; *ptr;)
+  {
+    const glyph& g = m_glyphs[(int)DecodeUTF8(ptr)];
+    if (g.width == 0)
+      continue;
 
-      if (i < length - 1)
+    for (int i = 0; i < g.width; i++)
+    {
+      unsigned int column = m_glyphcolumns[g.start + i];
+      for (int line = 0; line < m_fontheight; line++)
       {
-        charpos++;
-        pixlength++;
+        if (column & (1 << line))
+          m_titlestrip[(m_fontheight - line - 1) * m_stripbytes + x / 4] |= 1 << (6 - (x % 4) * 2);
       }
+      x++;
     }
+    x++;
   }
+}
+
+//copies the window of the title strip at the scroll offset, and scrolls long titles
+void CBitVis::DrawTitle(uint8_t* buff)
+{
+  const int rowbytes = m_tiler.RowBytes();
+
+  //pixel x of the display shows pixel x + start of the strip
+  const int start = m_nrcolumns - m_scrolloffset;
+  const int shift = (start % 4) * 2;
 
-  if (pixlength > m_nrcolumns && GetTimeUs() - m_songupdatetime > 2000000)
+  for (int line = 0; line < m_fontheight; line++)
+  {
+    const uint8_t* in  = &m_titlestrip[line * m_stripbytes + start / 4];
+    uint8_t*       out = buff + line * rowbytes;
+
+    if (shift == 0)
+    {
+      memcpy(out, in, rowbytes);
+    }
+    else
+    {
+      for (int i = 0; i < rowbytes; i++)
+        out[i] = (in[i] << shift) | (in[i + 1] >> (8 - shift));
+    }
+  }
+
+  if (m_titlepixels > m_nrcolumns && GetTimeUs() - m_songupdatetime > 2000000)
   {
     m_scrolloffset--;
-    if (m_scrolloffset < -pixlength)
+    if (m_scrolloffset < -m_titlepixels)
       m_scrolloffset = m_nrcolumns;
   }
 }
 
+//measures drawing a scrolling title, which only copies a window from the title strip
+void CBitVis::BenchmarkTitle()
+{
+  const int nrframes = 100000;
+
+  BuildTitleStrip("Some Artist - A Song Title That Is Much Too Long To Fit On The Display Without Scrolling");
+  m_songupdatetime = GetTimeUs() - 10000000;
+  m_scrolloffset = 0;
+
+  int64_t start = GetThreadCpuTimeUs();
+  for (int i = 0; i < nrframes; i++)
+    DrawTitle(m_textbuf);
+  int64_t drawtime = GetThreadCpuTimeUs() - start;
+
+  Log("Benchmark: drawing a %i pixel title: %.3f us per frame", m_titlepixels, (double)drawtime / nrframes);
+
+  BuildTitleStrip("");
+  m_songupdatetime = GetTimeUs();
+  m_scrolloffset = 0;
+}
+
 void CBitVis::InitChars()
 {
+  memset(m_glyphs, 0, sizeof(m_glyphs));
+
 #define GLYPH(index, pixels)\
   {\
     const unsigned int* pixarr = pixels;\
     size_t nrcolumns = sizeof(pixels) / sizeof(pixels[0]);\
-    std::vector<unsigned int> pixelvec;\
     int charheight = CharHeight(pixarr, nrcolumns);\
     if (m_fontheight < charheight)\
       m_fontheight = charheight;\
-    for (size_t i = 0; i < nrcolumns; i++)\
-      pixelvec.push_back(pixarr[i]);\
-    \
-    m_glyphs[index].swap(pixelvec);\
+    m_glyphs[(int)index].start = m_glyphcolumns.size();\
+    m_glyphs[(int)index].width = nrcolumns;\
+    m_glyphcolumns.insert(m_glyphcolumns.end(), pixarr, pixarr + nrcolumns);\
   }\
 
   GLYPH('a',  ((const unsigned int[]){0x18, 0xbc, 0xa4, 0xa4, 0xf8, 0x7c, 0x4}))
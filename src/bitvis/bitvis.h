@@ -19,20 +19,55 @@
 #ifndef BITVIS_H
 #define BITVIS_H
 
-#include <map>
 #include <vector>
 #include <deque>
 #include <utility>
 #include <samplerate.h>
 
+#include "audiosource.h"
 #include "jackclient.h"
 #include "fft.h"
+#include "binmap.h"
+#include "multiresfft.h"
+#include "scopecorrelator.h"
+#include "paneltiler.h"
+#include "panelconnection.h"
 #include "util/tcpsocket.h"
+#include "util/eventloop.h"
 #include "util/debugwindow.h"
+#include "util/frameencoder.h"
+#include "util/framepool.h"
+#include "util/latencyhistogram.h"
 #include "util/thread.h"
 #include "util/condition.h"
 #include "mpdclient.h"
 
+//number of display frames that can be queued between the analysis and render stage
+#define MAXSNAPSHOTS 8
+
+//number of rendered frames that can be queued for the sender thread
+#define MAXFRAMES 8
+
+//how often the write latency of the panel connections is logged
+#define WRITESTATSINTERVAL 10000000
+
+//how often the frame pacing statistics are logged, SIGUSR1 logs them immediately
+#define PACINGSTATSINTERVAL 60000000
+
+class CBitVis;
+
+//runs the render stage of CBitVis
+class CRenderThread : public CThread
+{
+  public:
+    CRenderThread(CBitVis& bitvis) : m_bitvis(bitvis) {}
+    virtual void Process();
+    bool         IsStopping() { return m_stop; }
+
+  private:
+    CBitVis& m_bitvis;
+};
+
 class CBitVis : public CThread
 {
   public:
@@ -44,25 +79,41 @@ class CBitVis : public CThread
     void Cleanup();
 
     virtual void Process();
+    void         ProcessRender();
 
   private:
     bool         m_stop;
-    char*        m_address;
+    std::vector<std::string> m_addresses;
+    std::vector<int>         m_ports;
     int          m_port;
     char*        m_mpdaddress;
     int          m_mpdport;
-    CJackClient  m_jackclient;
+    CAudioSource* m_audiosource;
+    char*        m_inputfile;
+    int          m_rawsamplerate;
+    bool         m_benchmark;
+    int          m_benchframes;
+    int64_t      m_benchcputime;
+    int64_t      m_benchrendertime;
     int          m_signalfd;
     Cfft         m_fft;
     float*       m_buf;
-    int          m_bufsize;
-    float*       m_fftbuf;
+    int64_t      m_overruns;
+    int64_t      m_overruntime;
     float*       m_displaybuf;
     int          m_samplecounter;
-    int          m_nrffts;
     int          m_nrbins;
+    int          m_overlap;
+    WindowType   m_window;
+    CBinMap      m_binmap;
+    FrequencyScale m_scale;
+    CMultiResFft m_multires;
+    int          m_multiresstages; //0 uses the single fft in m_fft
     int          m_nrcolumns;
     int          m_nrlines;
+    CPanelTiler  m_tiler;
+    uint8_t*     m_framebuf; //the framebuffer being rendered
+    uint8_t*     m_textbuf;
     int          m_fontdisplay;
     float        m_decay;
     int          m_fps;
@@ -70,6 +121,10 @@ class CBitVis : public CThread
     int          m_scrolloffset;
     int64_t      m_songupdatetime;
     CMpdClient*  m_mpdclient;
+    std::string  m_currentsong;
+    uint32_t     m_mpdsongversion;    //versions of the mpd state that the render thread has seen
+    uint32_t     m_mpdplayingversion;
+    uint32_t     m_mpdvolumeversion;
     int64_t      m_volumetime;
     int          m_displayvolume;
     bool         m_hasaudio;
@@ -79,14 +134,49 @@ class CBitVis : public CThread
 
     float*       m_scopebuf;
     int          m_scopebufsize;
+    float*       m_scopelinbuf;
     float*       m_scopecorrbuf;
+    int          m_scopesearch;
+    CScopeCorrelator m_scopecorrelator;
     float*       m_scopedisplaybuf;
     int          m_scopebufpos;
     float        m_scopemul;
     SRC_STATE*   m_srcstate;
+    float        m_scoperesamplebuf[256];
+
+    //what the analysis stage hands to the render stage for every display frame
+    struct snapshot
+    {
+      int64_t            time;
+      bool               hasaudio;
+      std::vector<float> spectrum;
+      std::vector<float> scope;
+    };
+
+    CCondition    m_snapshotcondition;
+    snapshot      m_snapshots[MAXSNAPSHOTS];
+    int64_t       m_snapshotread;
+    int64_t       m_snapshotwrite;
+    int64_t       m_droppedsnapshots;
+    int64_t       m_droppedreported;
+    int64_t       m_droppedtime;
+    snapshot      m_rendersnapshot;
+    CRenderThread m_renderthread;
 
+    //a rendered framebuffer of the whole display, the sender thread writes each panel from it
+    struct frame
+    {
+      int64_t time;      //when the frame should be sent
+      int64_t audiotime; //when the audio it shows was captured
+      CFrame* frame;
+    };
+
+    CFramePool   m_framepool;
     CCondition   m_condition;
-    std::deque< std::pair<int64_t, CTcpData> > m_data;
+    frame        m_frames[MAXFRAMES];
+    int64_t      m_frameread;
+    int64_t      m_framewrite;
+    std::vector<struct iovec> m_iovecs;
 
     bool         m_debug;
     int          m_debugscale;
@@ -99,18 +189,72 @@ class CBitVis : public CThread
     };
 
     peak*        m_peakholds;
+
+    //per column values for rendering, computed once per frame
+    struct column
+    {
+      int bar;       //height of the spectrum bar
+      int peak;      //line of the peak hold
+      int scopelow;  //lowest line of the scope
+      int scopehigh; //highest line of the scope
+    };
+
+    column*      m_columnstate;
     bool         m_peakup;
 
-    CMutex           m_socketlock;
-    CTcpClientSocket m_socket;
+    CEventLoop        m_eventloop;
+    CPanelConnection* m_connections;
+    CFrameEncoder     m_debugencoder;
+    bool              m_delta;
+
+    //frame pacing, owned by the sender thread
+    int64_t           m_spintime;    //busy wait this many microseconds before a frame is sent
+    int64_t           m_outputlatency; //from when the audio arrived to when it's heard, frames are sent that much later
+    CLatencyHistogram m_jitter;      //how late frames are sent after their deadline
+    int64_t           m_pacedframes;
+    int64_t           m_lateframes;  //frames that were queued after their deadline had passed
+    int64_t           m_staleframes; //frames dropped because a newer one was queued after their deadline
+    int64_t           m_stalereported;
+    int64_t           m_staletime;
+    int64_t           m_queuedframes; //sum of the queue depth, for the average
+    int64_t           m_maxqueuedepth;
+    CLatencyHistogram m_wirelatency; //from audio capture until the frame is written
+    volatile bool     m_logpacing;   //set on SIGUSR1
+
+    //glyphs are columns of pixels with bit 0 at the bottom, stored in m_glyphcolumns,
+    //indexed by ascii character, a width of 0 means there's no glyph
+    struct glyph
+    {
+      int start;
+      int width;
+    };
+
+    glyph                     m_glyphs[128];
+    std::vector<unsigned int> m_glyphcolumns;
 
-    std::map<char, std::vector<unsigned int> > m_glyphs;
+    //the song text is rendered once into a strip with m_nrcolumns empty pixels on both sides,
+    //every frame copies a window from it at the scroll offset
+    std::vector<uint8_t>      m_titlestrip;
+    int                       m_stripbytes;
+    int                       m_titlepixels;
 
     void SetupSignals();
     void ProcessSignalfd();
     void ProcessAudio();
-    void SendData(int64_t time);
-    void SetText(uint8_t* buff, const char* str, int offset = 0);
+    void CheckOverruns();
+    void ResampleScope(float* in, int nrsamples, int samplerate);
+    void BenchmarkScopeResampler();
+    void QueueSnapshot(int64_t time);
+    void SendData(const snapshot& snap);
+    void RenderSpectrum(const snapshot& snap, int nrlines, bool drawbar, int elapsed);
+    void BenchmarkRenderer();
+    void LogBenchmark();
+    void LogWriteStats();
+    void RunEventLoop(int64_t until);
+    void LogPacing();
+    void BuildTitleStrip(const char* str);
+    void DrawTitle(uint8_t* buff);
+    void BenchmarkTitle();
     int CharHeight(const unsigned int* in, size_t size);
     void InitChars();
     static void JackError(const char* jackerror);
@@ -0,0 +1,85 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "decimator.h"
+
+CDecimator::CDecimator()
+{
+  //windowed sinc with the cutoff at a quarter of the samplerate,
+  //every even tap except the center one is 0, so only the odd ones are stored
+  const int center = HALFBANDTAPS / 2;
+  float sum = 0.5f;
+  for (int i = 1; i <= center; i += 2)
+  {
+    float x = 2.0f * M_PI * (center + i) / (HALFBANDTAPS - 1.0f);
+    float window = 0.42f - 0.5f * cosf(x) + 0.08f * cosf(2.0f * x);
+    float tap = sinf(M_PI * i / 2.0f) / (M_PI * i) * window;
+
+    m_halfband.push_back(tap);
+    sum += tap * 2.0f;
+  }
+
+  //unity gain at dc
+  for (size_t i = 0; i < m_halfband.size(); i++)
+    m_halfband[i] /= sum;
+  m_center = 0.5f / sum;
+
+  Reset();
+}
+
+void CDecimator::Reset()
+{
+  m_history.assign(HALFBANDTAPS - 1, 0.0f);
+  m_phase = 0;
+}
+
+int CDecimator::Process(const float* samples, int nrsamples, float*& out)
+{
+  //the history and the new samples in one linear buffer, so the filter doesn't wrap around
+  const int historysize = HALFBANDTAPS - 1;
+  m_work.resize(historysize + nrsamples);
+  memcpy(&m_work[0], &m_history[0], historysize * sizeof(float));
+  memcpy(&m_work[historysize], samples, nrsamples * sizeof(float));
+
+  m_output.resize(nrsamples / 2 + 1);
+
+  const int    center    = HALFBANDTAPS / 2;
+  const int    nrtaps    = m_halfband.size();
+  const float* halfband  = &m_halfband[0];
+  int          nroutputs = 0;
+  int          i;
+  for (i = m_phase; i < nrsamples; i += 2)
+  {
+    //the filter ends at input sample i
+    const float* in = &m_work[i + center];
+    float value = in[0] * m_center;
+    for (int j = 0; j < nrtaps; j++)
+      value += (in[-(j * 2 + 1)] + in[j * 2 + 1]) * halfband[j];
+
+    m_output[nroutputs++] = value;
+  }
+
+  m_phase = i - nrsamples;
+  memcpy(&m_history[0], &m_work[nrsamples], historysize * sizeof(float));
+
+  out = &m_output[0];
+  return nroutputs;
+}
@@ -0,0 +1,56 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <vector>
+
+//length of the halfband lowpass
+#define HALFBANDTAPS 63
+
+//with HALFBANDTAPS, the decimated signal is clean up to this fraction of its samplerate,
+//above that the filter rolls off and aliasing comes in
+#define DECIMATORPASSBAND 0.4f
+
+//halves the samplerate with a halfband lowpass, and keeping every other sample,
+//keeps its state between blocks, so the output doesn't depend on how the input is split up
+class CDecimator
+{
+  public:
+    CDecimator();
+
+    void Reset();
+
+    //out points to an internal buffer that stays valid until the next call, returns the number of output samples,
+    //the buffer only reallocates when a larger block comes in than before
+    int  Process(const float* samples, int nrsamples, float*& out);
+
+    //the lowpass delays the signal by this many input samples
+    static int Delay() { return HALFBANDTAPS / 2; }
+
+  private:
+    std::vector<float> m_halfband; //odd taps from the center out, the even ones are 0
+    float              m_center;
+    std::vector<float> m_history;  //the last HALFBANDTAPS - 1 input samples
+    std::vector<float> m_work;
+    std::vector<float> m_output;
+    int                m_phase;    //index of the next input sample that makes an output sample
+};
+
+#endif //DECIMATOR_H
@@ -17,12 +17,84 @@
  */
 
 #include <math.h>
-#include <stdlib.h> //TODO: REMOVE
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <vector>
 
 #include "fft.h"
 #include "util/timeutils.h"
 #include "util/log.h"
+#include "util/lock.h"
+
+std::string Cfft::m_wisdomfile;
+
+CFftPlanner::CFftPlanner()
+{
+  m_active = false;
+}
+
+//the thread uses m_queue, so it's joined before that's destroyed
+CFftPlanner::~CFftPlanner()
+{
+  StopThread();
+}
+
+//called with the planner lock held
+void CFftPlanner::Queue(Cfft* fft)
+{
+  m_queue.push_back(fft);
+}
+
+//called with the planner lock held, so the fft isn't being measured
+void CFftPlanner::Remove(Cfft* fft)
+{
+  for (std::vector<Cfft*>::iterator it = m_queue.begin(); it != m_queue.end();)
+  {
+    if (*it == fft)
+      it = m_queue.erase(it);
+    else
+      ++it;
+  }
+}
+
+void CFftPlanner::Start()
+{
+  CLock lock(Cfft::PlannerLock());
+  if (m_active || m_queue.empty())
+    return;
+
+  m_active = true;
+  lock.Leave();
+
+  //the previous run cleared m_active and returned, join it before starting a new one
+  JoinThread();
+  StartThread();
+}
+
+//the lock is let go between measurements, so others that make or destroy plans get a chance in between
+void CFftPlanner::Process()
+{
+  bool measured = false;
+  for (;;)
+  {
+    CLock lock(Cfft::PlannerLock());
+    if (m_stop || m_queue.empty())
+    {
+      if (measured)
+        Cfft::SaveWisdom();
+
+      m_active = false;
+      return;
+    }
+
+    Cfft* fft = m_queue.front();
+    m_queue.erase(m_queue.begin());
+
+    if (fft->BuildMeasuredPlan())
+      measured = true;
+  }
+}
 
 Cfft::Cfft()
 {
@@ -32,7 +104,18 @@ Cfft::Cfft()
   m_outbuf = NULL;
   m_window = NULL;
   m_bufsize = 0;
+  m_hop = 0;
+  m_hopcounter = 0;
+  m_windowtype = WindowHamming;
+  m_scale = 0.0f;
   m_plan = NULL;
+  m_estimatedplan = NULL;
+  m_measuredplan = NULL;
+  m_magnitudes = NULL;
+  m_nrbins = 0;
+  m_nrframes = 0;
+
+  SetKernelType(BestKernelType());
 }
 
 Cfft::~Cfft()
@@ -40,71 +123,343 @@ Cfft::~Cfft()
   Free();
 }
 
-void Cfft::Allocate(unsigned int size)
+void Cfft::Allocate(unsigned int size, unsigned int hop, WindowType window)
 {
-  if (size != m_bufsize)
+  if (hop < 1)
+    hop = 1;
+  else if (hop > size)
+    hop = size;
+
+  //the counter can be past a smaller hop, which would never match it again
+  if (hop != m_hop)
+  {
+    m_hop = hop;
+    m_hopcounter = 0;
+  }
+
+  if (size != m_bufsize || window != m_windowtype)
   {
     Free();
 
     m_bufsize = size;
+    m_hop = hop;
+    m_windowtype = window;
+    m_nrbins = m_bufsize / 2;
     m_inbuf = new float[m_bufsize];
-    m_fftin = (float*)fftw_malloc(m_bufsize * sizeof(float));
-    m_outbuf = (fftwf_complex*)fftw_malloc(m_bufsize * sizeof(fftwf_complex));
+    memset(m_inbuf, 0, m_bufsize * sizeof(float));
+    m_fftin = (float*)fftwf_malloc(m_bufsize * sizeof(float));
+    m_outbuf = (fftwf_complex*)fftwf_malloc(m_bufsize * sizeof(fftwf_complex));
     m_window = new float[m_bufsize];
+    m_magnitudes = new float[m_nrbins];
+    ResetMagnitudes();
 
-    //create a hamming window
+    float windowsum = 0.0f;
     for (unsigned int i = 0; i < m_bufsize; i++)
-      m_window[i] = 0.54f - 0.46f * cosf(2.0f * M_PI * i / (m_bufsize - 1.0f));
+    {
+      float x = 2.0f * M_PI * i / (m_bufsize - 1.0f);
+      if (m_windowtype == WindowHann)
+        m_window[i] = 0.5f - 0.5f * cosf(x);
+      else if (m_windowtype == WindowBlackmanHarris)
+        m_window[i] = 0.35875f - 0.48829f * cosf(x) + 0.14128f * cosf(2.0f * x) - 0.01168f * cosf(3.0f * x);
+      else
+        m_window[i] = 0.54f - 0.46f * cosf(x);
+
+      windowsum += m_window[i];
+    }
 
-    Log("Building fft plan");
-    int64_t start = GetTimeUs();
-    m_plan = fftwf_plan_dft_r2c_1d(m_bufsize, m_fftin, m_outbuf, FFTW_MEASURE);
-    Log("Built fft plan in %.0f ms", (double)(GetTimeUs() - start) / 1000.0f);
+    //normalize the magnitudes to the gain of the hamming window,
+    //since the display levels were tuned with that
+    m_scale = 0.54f / windowsum;
+
+    Log("Building fft plan, size %u hop %u window %s kernels %s",
+        m_bufsize, m_hop, WindowToString(m_windowtype), KernelTypeToString(m_kerneltype));
+
+    //with wisdom for this size the measured plan is made right away,
+    //otherwise an estimated plan is used until the planner thread has measured one
+    CLock lock(PlannerLock());
+    m_measuredplan = fftwf_plan_dft_r2c_1d(m_bufsize, m_fftin, m_outbuf, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+    if (m_measuredplan)
+    {
+      m_plan = m_measuredplan;
+      lock.Leave();
+
+      Log("Using measured fft plan from wisdom");
+    }
+    else
+    {
+      m_estimatedplan = fftwf_plan_dft_r2c_1d(m_bufsize, m_fftin, m_outbuf, FFTW_ESTIMATE);
+      m_plan = m_estimatedplan;
+      Planner().Queue(this);
+      lock.Leave();
+
+      Log("Using estimated fft plan until a measured one is built in the background");
+    }
   }
 }
 
+//FFTW_MEASURE overwrites the arrays, so it plans on its own arrays,
+//the arrays all come from fftwf_malloc, which aligns them for fftwf_execute_dft_r2c on m_fftin and m_outbuf
+//called from the planner thread with the planner lock held
+bool Cfft::BuildMeasuredPlan()
+{
+  float*         in  = (float*)fftwf_malloc(m_bufsize * sizeof(float));
+  fftwf_complex* out = (fftwf_complex*)fftwf_malloc(m_bufsize * sizeof(fftwf_complex));
+
+  int64_t start = GetTimeUs();
+  fftwf_plan plan = fftwf_plan_dft_r2c_1d(m_bufsize, in, out, FFTW_MEASURE);
+  int64_t plantime = GetTimeUs() - start;
+
+  fftwf_free(in);
+  fftwf_free(out);
+
+  if (!plan)
+  {
+    LogError("Unable to build measured fft plan for size %u", m_bufsize);
+    return false;
+  }
+
+  Log("Built measured fft plan for size %u in %.0f ms", m_bufsize, (double)plantime / 1000.0);
+  __atomic_store_n(&m_measuredplan, plan, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+//called from the planner thread with the planner lock held
+void Cfft::SaveWisdom()
+{
+  if (m_wisdomfile.empty())
+    return;
+
+  //write to a temporary file first, so a crash doesn't leave half a wisdom file
+  std::string tmpfile = m_wisdomfile + ".tmp";
+  if (fftwf_export_wisdom_to_filename(tmpfile.c_str()) && rename(tmpfile.c_str(), m_wisdomfile.c_str()) == 0)
+    LogDebug("Saved fftw wisdom to %s", m_wisdomfile.c_str());
+  else
+    LogError("Unable to save fftw wisdom to %s", m_wisdomfile.c_str());
+}
+
+void Cfft::WaitForPlan()
+{
+  //the planner thread returns when its queue is empty
+  Planner().Start();
+  Planner().JoinThread();
+
+  fftwf_plan measured = __atomic_load_n(&m_measuredplan, __ATOMIC_ACQUIRE);
+  if (measured)
+    m_plan = measured;
+}
+
+void Cfft::StartPlanner()
+{
+  Planner().Start();
+}
+
+CFftPlanner& Cfft::Planner()
+{
+  //the lock is made first, so it's destroyed after the planner thread is joined at exit
+  PlannerLock();
+  static CFftPlanner planner;
+  return planner;
+}
+
+void Cfft::SetWisdomFile(const std::string& filename)
+{
+  CLock lock(PlannerLock());
+  m_wisdomfile = filename;
+
+  if (fftwf_import_wisdom_from_filename(filename.c_str()))
+    Log("Loaded fftw wisdom from %s", filename.c_str());
+  else
+    Log("No fftw wisdom loaded from %s, measured fft plans will be built in the background", filename.c_str());
+}
+
+CMutex& Cfft::PlannerLock()
+{
+  static CMutex plannerlock;
+  return plannerlock;
+}
+
 void Cfft::Free()
 {
+  //only an fft with a plan can be in the planner queue, without one there's nothing to lock for,
+  //otherwise this waits until a measurement that's in progress is done
+  if (m_estimatedplan || m_measuredplan)
+  {
+    CLock lock(PlannerLock());
+    Planner().Remove(this);
+
+    if (m_estimatedplan)
+    {
+      fftwf_destroy_plan(m_estimatedplan);
+      m_estimatedplan = NULL;
+    }
+
+    if (m_measuredplan)
+    {
+      fftwf_destroy_plan(m_measuredplan);
+      m_measuredplan = NULL;
+    }
+  }
+
+  m_plan = NULL;
+
   delete[] m_inbuf;
-  fftw_free(m_fftin);
-  fftw_free(m_outbuf);
+  fftwf_free(m_fftin);
+  fftwf_free(m_outbuf);
   delete[] m_window;
+  delete[] m_magnitudes;
   m_inbuf = NULL;
   m_inbufpos = 0;
   m_fftin = NULL;
   m_outbuf = NULL;
   m_window = NULL;
+  m_magnitudes = NULL;
   m_bufsize = 0;
+  m_hopcounter = 0;
+  m_nrbins = 0;
+  m_nrframes = 0;
+}
+
+//adds samples to the ring buffer, and does an fft every time m_hop samples have been added
+void Cfft::AddSamples(const float* samples, unsigned int nrsamples)
+{
+  while (nrsamples > 0)
+  {
+    unsigned int size = m_hop - m_hopcounter;
+    if (size > nrsamples)
+      size = nrsamples;
+
+    //copy up to the end of the ring buffer, then wrap around
+    unsigned int tail = m_bufsize - m_inbufpos;
+    if (size <= tail)
+    {
+      memcpy(m_inbuf + m_inbufpos, samples, size * sizeof(float));
+    }
+    else
+    {
+      memcpy(m_inbuf + m_inbufpos, samples, tail * sizeof(float));
+      memcpy(m_inbuf, samples + tail, (size - tail) * sizeof(float));
+    }
 
-  if (m_plan)
+    m_inbufpos += size;
+    if (m_inbufpos >= m_bufsize)
+      m_inbufpos -= m_bufsize;
+
+    samples += size;
+    nrsamples -= size;
+    m_hopcounter += size;
+
+    if (m_hopcounter == m_hop)
+    {
+      m_hopcounter = 0;
+      Process();
+    }
+  }
+}
+
+void Cfft::ResetMagnitudes()
+{
+  memset(m_magnitudes, 0, m_nrbins * sizeof(float));
+  m_nrframes = 0;
+}
+
+void Cfft::SetKernelType(KernelType type)
+{
+  m_kerneltype = type;
+  m_windowkernel = GetWindowKernel(type);
+  m_magnitudekernel = GetMagnitudeKernel(type);
+}
+
+void Cfft::Process()
+{
+  //switch to the measured plan once the planner thread has built it
+  if (m_plan == m_estimatedplan)
   {
-    fftwf_destroy_plan(m_plan);
-    m_plan = NULL;
+    fftwf_plan measured = __atomic_load_n(&m_measuredplan, __ATOMIC_ACQUIRE);
+    if (measured)
+      m_plan = measured;
   }
+
+  ApplyWindow();
+  fftwf_execute_dft_r2c(m_plan, m_fftin, m_outbuf);
+  m_magnitudekernel(m_outbuf, m_magnitudes, m_scale, m_nrbins);
+  m_nrframes++;
 }
 
+//the oldest sample is at m_inbufpos, so the window is applied in two parts
 void Cfft::ApplyWindow()
 {
-  float* in = m_inbuf + m_inbufpos;
-  float* inend = m_inbuf + m_bufsize;
-  float* out = m_fftin;
-  float* window = m_window;
+  unsigned int tail = m_bufsize - m_inbufpos;
+  m_windowkernel(m_inbuf + m_inbufpos, m_window, m_fftin, tail);
+  m_windowkernel(m_inbuf, m_window + tail, m_fftin + tail, m_inbufpos);
+}
 
-  while (in != inend)
-    *(out++) = *(in++) * *(window++);
+//logs the cost per fft frame for every supported kernel type, at several fft sizes
+void Cfft::Benchmark()
+{
+  const unsigned int sizes[] = { 2048, 4096, 8192, 16384, 32768 };
+  const int          nrframes = 2000;
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    Cfft fft;
+    fft.Allocate(sizes[i], sizes[i], WindowHamming);
+    fft.WaitForPlan();
+
+    std::vector<float> samples(sizes[i]);
+    for (size_t j = 0; j < samples.size(); j++)
+      samples[j] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+
+    fft.AddSamples(&samples[0], samples.size());
+
+    for (int type = KernelScalar; type <= KernelAVX2; type++)
+    {
+      if (!KernelSupported((KernelType)type))
+        continue;
+
+      fft.SetKernelType((KernelType)type);
 
-  in = m_inbuf;
-  inend = m_inbuf + m_inbufpos;
+      int64_t start = GetThreadCpuTimeUs();
+      for (int j = 0; j < nrframes; j++)
+      {
+        fft.ApplyWindow();
+        fft.m_magnitudekernel(fft.m_outbuf, fft.m_magnitudes, fft.m_scale, fft.m_nrbins);
+      }
+      int64_t kerneltime = GetThreadCpuTimeUs() - start;
 
-  while (in != inend)
-    *(out++) = *(in++) * *(window++);
+      start = GetThreadCpuTimeUs();
+      for (int j = 0; j < nrframes; j++)
+        fft.Process();
+      int64_t frametime = GetThreadCpuTimeUs() - start;
+
+      Log("Benchmark: fft size %5u kernels %-6s: %8.2f us per frame, of which %7.2f us window and magnitude",
+          sizes[i], KernelTypeToString((KernelType)type),
+          (double)frametime / nrframes, (double)kerneltime / nrframes);
+    }
+  }
+}
+
+const char* Cfft::WindowToString(WindowType window)
+{
+  if (window == WindowHann)
+    return "hann";
+  else if (window == WindowBlackmanHarris)
+    return "blackmanharris";
+  else
+    return "hamming";
 }
 
-void Cfft::AddSample(float sample)
+bool Cfft::StringToWindow(const char* str, WindowType& window)
 {
-  m_inbuf[m_inbufpos] = sample;
-  m_inbufpos++;
-  if (m_inbufpos == m_bufsize)
-    m_inbufpos = 0;
+  if (strcasecmp(str, "hamming") == 0)
+    window = WindowHamming;
+  else if (strcasecmp(str, "hann") == 0)
+    window = WindowHann;
+  else if (strcasecmp(str, "blackmanharris") == 0)
+    window = WindowBlackmanHarris;
+  else
+    return false;
+
+  return true;
 }
 
@@ -22,26 +22,106 @@
 #include <complex.h>
 #include <fftw3.h>
 
+#include <string>
+#include <vector>
+
+#include "fftkernels.h"
+#include "util/thread.h"
+#include "util/mutex.h"
+
+enum WindowType
+{
+  WindowHamming,
+  WindowHann,
+  WindowBlackmanHarris,
+};
+
+class Cfft;
+
+//measures fft plans in a background thread, since FFTW_MEASURE can take seconds,
+//ffts queue themselves in Allocate(), and one thread measures them all once Start() is called,
+//so the estimated plans are all made before anything holds the planner lock for a measurement
+//the queue is protected by Cfft::PlannerLock()
+class CFftPlanner : public CThread
+{
+  public:
+    CFftPlanner();
+    ~CFftPlanner();
+
+    void Queue(Cfft* fft);
+    void Remove(Cfft* fft);
+    void Start();
+
+  private:
+    virtual void Process();
+
+    std::vector<Cfft*> m_queue;
+    bool               m_active; //set by Start(), cleared when the thread found the queue empty
+};
+
+//short time fourier transform, samples are added in blocks and an fft is done
+//every m_hop samples, the magnitudes of all ffts are accumulated in m_magnitudes
 class Cfft
 {
   public:
     Cfft();
     ~Cfft();
 
-    void Allocate(unsigned int size);
+    void Allocate(unsigned int size, unsigned int hop, WindowType window);
     void Free();
-    void ApplyWindow();
-    void AddSample(float sample);
-    
+    void AddSamples(const float* samples, unsigned int nrsamples);
+    void ResetMagnitudes();
+    void SetKernelType(KernelType type);
+
+    //waits until the measured plan is built, and uses it
+    void WaitForPlan();
+
+    //starts measuring the plans of all ffts allocated so far in the background,
+    //call this once everything that makes fft plans is allocated
+    static void        StartPlanner();
+
+    //loads fftw wisdom from the file, measured plans are saved to it
+    static void        SetWisdomFile(const std::string& filename);
+
+    //fftw's planner isn't thread safe, everything that makes or destroys plans has to hold this
+    static CMutex&     PlannerLock();
+
+    static const char* WindowToString(WindowType window);
+    static bool        StringToWindow(const char* str, WindowType& window);
+    static void        Benchmark();
+
     float*         m_inbuf;
     unsigned int   m_inbufpos;
     float*         m_fftin;
     float*         m_window;
     fftwf_complex* m_outbuf;
     unsigned int   m_bufsize;
-    fftwf_plan     m_plan;
+    unsigned int   m_hop;
+    unsigned int   m_hopcounter;
+    WindowType     m_windowtype;
+    float          m_scale;
+    fftwf_plan     m_plan;          //the plan that's executed, either the estimated or the measured one
+    fftwf_plan     m_estimatedplan;
+    fftwf_plan     m_measuredplan;  //set by the planner thread when it's done
+
+    KernelType      m_kerneltype;
+    WindowKernel    m_windowkernel;
+    MagnitudeKernel m_magnitudekernel;
+
+    float*         m_magnitudes;
+    unsigned int   m_nrbins;
+    unsigned int   m_nrframes;
 
   private:
+    friend class CFftPlanner;
+
+    void ApplyWindow();
+    void Process();
+    bool BuildMeasuredPlan();
+
+    static CFftPlanner& Planner();
+    static void         SaveWisdom();
 
+    static std::string m_wisdomfile;
 };
 #endif //FFT_H
@@ -0,0 +1,171 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "fftkernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define HAVE_X86_KERNELS
+  #include <immintrin.h>
+#endif
+
+static void WindowScalar(const float* in, const float* window, float* out, unsigned int size)
+{
+  for (unsigned int i = 0; i < size; i++)
+    out[i] = in[i] * window[i];
+}
+
+static void MagnitudeScalar(const fftwf_complex* in, float* accum, float scale, unsigned int size)
+{
+  for (unsigned int i = 0; i < size; i++)
+    accum[i] += sqrtf(in[i][0] * in[i][0] + in[i][1] * in[i][1]) * scale;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+//these are compiled for their own instruction set with the target attribute,
+//so they work without building everything with -march
+__attribute__((target("sse2")))
+static void WindowSSE2(const float* in, const float* window, float* out, unsigned int size)
+{
+  unsigned int i = 0;
+  for (; i + 4 <= size; i += 4)
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(window + i)));
+
+  WindowScalar(in + i, window + i, out + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static void MagnitudeSSE2(const fftwf_complex* in, float* accum, float scale, unsigned int size)
+{
+  const float* inptr = (const float*)in;
+  __m128 vscale = _mm_set1_ps(scale);
+
+  unsigned int i = 0;
+  for (; i + 4 <= size; i += 4)
+  {
+    //deinterleave 4 complex values into real and imaginary parts
+    __m128 a    = _mm_loadu_ps(inptr + i * 2);
+    __m128 b    = _mm_loadu_ps(inptr + i * 2 + 4);
+    __m128 real = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 imag = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m128 power = _mm_add_ps(_mm_mul_ps(real, real), _mm_mul_ps(imag, imag));
+    __m128 sum   = _mm_add_ps(_mm_loadu_ps(accum + i), _mm_mul_ps(_mm_sqrt_ps(power), vscale));
+    _mm_storeu_ps(accum + i, sum);
+  }
+
+  MagnitudeScalar(in + i, accum + i, scale, size - i);
+}
+
+__attribute__((target("avx2")))
+static void WindowAVX2(const float* in, const float* window, float* out, unsigned int size)
+{
+  unsigned int i = 0;
+  for (; i + 8 <= size; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_loadu_ps(window + i)));
+
+  WindowScalar(in + i, window + i, out + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void MagnitudeAVX2(const fftwf_complex* in, float* accum, float scale, unsigned int size)
+{
+  const float* inptr = (const float*)in;
+  __m256 vscale = _mm256_set1_ps(scale);
+
+  unsigned int i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    //the shuffle works per 128 bit lane, so this gives 0 1 4 5 2 3 6 7
+    __m256 a    = _mm256_loadu_ps(inptr + i * 2);
+    __m256 b    = _mm256_loadu_ps(inptr + i * 2 + 8);
+    __m256 real = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 imag = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m256 power     = _mm256_add_ps(_mm256_mul_ps(real, real), _mm256_mul_ps(imag, imag));
+    __m256 magnitude = _mm256_mul_ps(_mm256_sqrt_ps(power), vscale);
+
+    //put the magnitudes back in order
+    magnitude = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(magnitude), _MM_SHUFFLE(3, 1, 2, 0)));
+
+    _mm256_storeu_ps(accum + i, _mm256_add_ps(_mm256_loadu_ps(accum + i), magnitude));
+  }
+
+  MagnitudeScalar(in + i, accum + i, scale, size - i);
+}
+
+#endif //HAVE_X86_KERNELS
+
+KernelType BestKernelType()
+{
+  if (KernelSupported(KernelAVX2))
+    return KernelAVX2;
+  else if (KernelSupported(KernelSSE2))
+    return KernelSSE2;
+  else
+    return KernelScalar;
+}
+
+bool KernelSupported(KernelType type)
+{
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (type == KernelAVX2)
+    return __builtin_cpu_supports("avx2");
+  else if (type == KernelSSE2)
+    return __builtin_cpu_supports("sse2");
+#endif
+
+  return type == KernelScalar;
+}
+
+const char* KernelTypeToString(KernelType type)
+{
+  if (type == KernelAVX2)
+    return "avx2";
+  else if (type == KernelSSE2)
+    return "sse2";
+  else
+    return "scalar";
+}
+
+WindowKernel GetWindowKernel(KernelType type)
+{
+#ifdef HAVE_X86_KERNELS
+  if (type == KernelAVX2)
+    return WindowAVX2;
+  else if (type == KernelSSE2)
+    return WindowSSE2;
+#endif
+
+  return WindowScalar;
+}
+
+MagnitudeKernel GetMagnitudeKernel(KernelType type)
+{
+#ifdef HAVE_X86_KERNELS
+  if (type == KernelAVX2)
+    return MagnitudeAVX2;
+  else if (type == KernelSSE2)
+    return MagnitudeSSE2;
+#endif
+
+  return MagnitudeScalar;
+}
@@ -0,0 +1,45 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFTKERNELS_H
+#define FFTKERNELS_H
+
+#include <complex.h>
+#include <fftw3.h>
+
+//vectorized versions of the inner loops of Cfft, the instruction set is picked at runtime
+enum KernelType
+{
+  KernelScalar,
+  KernelSSE2,
+  KernelAVX2,
+};
+
+//out[i] = in[i] * window[i]
+typedef void (*WindowKernel)(const float* in, const float* window, float* out, unsigned int size);
+
+//accum[i] += |in[i]| * scale
+typedef void (*MagnitudeKernel)(const fftwf_complex* in, float* accum, float scale, unsigned int size);
+
+KernelType      BestKernelType();
+bool            KernelSupported(KernelType type);
+const char*     KernelTypeToString(KernelType type);
+WindowKernel    GetWindowKernel(KernelType type);
+MagnitudeKernel GetMagnitudeKernel(KernelType type);
+
+#endif //FFTKERNELS_H
@@ -0,0 +1,285 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/inclstdint.h"
+#include "util/misc.h"
+#include "util/timeutils.h"
+#include "util/log.h"
+
+#include "filesource.h"
+
+using namespace std;
+
+//number of frames read from the file per call to GetAudio, about the size of a jack period
+#define BLOCKFRAMES 1024
+
+static uint32_t ReadLE(const uint8_t* data, int bytes)
+{
+  uint32_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+    value = (value << 8) | data[i];
+
+  return value;
+}
+
+CFileSource::CFileSource(const std::string& filename, bool realtime, int rawsamplerate)
+{
+  m_filename       = filename;
+  m_realtime       = realtime;
+  m_file           = NULL;
+  m_connected      = false;
+  m_finished       = false;
+  m_samplerate     = rawsamplerate;
+  m_outsamplerate  = 40000;
+  m_channels       = 1;
+  m_bytespersample = 2;
+  m_isfloat        = false;
+  m_datasize       = -1;
+  m_starttime      = 0;
+  m_inframes       = 0;
+  m_srcstate       = NULL;
+}
+
+CFileSource::~CFileSource()
+{
+  Disconnect();
+}
+
+bool CFileSource::Connect()
+{
+  if (m_connected)
+    return true;
+
+  m_file = fopen(m_filename.c_str(), "rb");
+  if (m_file == NULL)
+  {
+    LogError("Unable to open \"%s\": %s", m_filename.c_str(), GetErrno().c_str());
+    m_finished = true;
+    return false;
+  }
+
+  if (!ReadWavHeader())
+  {
+    Disconnect();
+    m_finished = true;
+    return false;
+  }
+
+  int error;
+  m_srcstate = src_new(SRC_SINC_FASTEST, 1, &error);
+
+  m_filebuf.resize(BLOCKFRAMES * m_channels * m_bytespersample);
+  m_inbuf.resize(BLOCKFRAMES);
+
+  m_starttime = GetTimeUs();
+  m_inframes  = 0;
+  m_connected = true;
+
+  Log("Opened \"%s\", samplerate %i, %i channels, %i bits%s, %s",
+      m_filename.c_str(), m_samplerate, m_channels, m_bytespersample * 8, m_isfloat ? " float" : "",
+      m_realtime ? "realtime" : "as fast as possible");
+
+  return true;
+}
+
+void CFileSource::Disconnect()
+{
+  if (m_file)
+  {
+    fclose(m_file);
+    m_file = NULL;
+  }
+
+  if (m_srcstate)
+  {
+    src_delete(m_srcstate);
+    m_srcstate = NULL;
+  }
+
+  m_connected = false;
+}
+
+//parses the RIFF header, if the file doesn't have one it's read as raw samples
+bool CFileSource::ReadWavHeader()
+{
+  uint8_t header[12];
+  if (fread(header, 1, sizeof(header), m_file) != sizeof(header) ||
+      memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+  {
+    Log("\"%s\" is not a wav file, reading as raw signed 16 bit mono", m_filename.c_str());
+    rewind(m_file);
+    return true;
+  }
+
+  bool hasformat = false;
+  while (1)
+  {
+    uint8_t chunk[8];
+    if (fread(chunk, 1, sizeof(chunk), m_file) != sizeof(chunk))
+    {
+      LogError("\"%s\" has no data chunk", m_filename.c_str());
+      return false;
+    }
+
+    uint32_t chunksize = ReadLE(chunk + 4, 4);
+
+    if (memcmp(chunk, "fmt ", 4) == 0)
+    {
+      uint8_t format[40] = {};
+      size_t  readsize = Min(chunksize, sizeof(format));
+      if (chunksize < 16 || fread(format, 1, readsize, m_file) != readsize)
+      {
+        LogError("\"%s\" has an invalid format chunk", m_filename.c_str());
+        return false;
+      }
+
+      //WAVE_FORMAT_EXTENSIBLE stores the real format tag in the subformat guid
+      int formattag    = ReadLE(format, 2);
+      if (formattag == 0xFFFE && chunksize >= 26)
+        formattag = ReadLE(format + 24, 2);
+
+      m_channels       = ReadLE(format + 2, 2);
+      m_samplerate     = ReadLE(format + 4, 4);
+      m_bytespersample = (ReadLE(format + 14, 2) + 7) / 8;
+      m_isfloat        = formattag == 3;
+
+      if ((formattag != 1 && formattag != 3) || m_channels < 1 || m_samplerate <= 0 ||
+          (m_isfloat && m_bytespersample != 4) || m_bytespersample < 1 || m_bytespersample > 4)
+      {
+        LogError("\"%s\" has an unsupported format, tag:%i channels:%i bytes per sample:%i",
+                 m_filename.c_str(), formattag, m_channels, m_bytespersample);
+        return false;
+      }
+
+      hasformat = true;
+      chunksize -= readsize;
+    }
+    else if (memcmp(chunk, "data", 4) == 0)
+    {
+      if (!hasformat)
+      {
+        LogError("\"%s\" has a data chunk before the format chunk", m_filename.c_str());
+        return false;
+      }
+
+      m_datasize = chunksize;
+      return true;
+    }
+
+    //chunks are padded to an even size
+    if (fseek(m_file, chunksize + (chunksize & 1), SEEK_CUR) != 0)
+    {
+      LogError("Seeking \"%s\": %s", m_filename.c_str(), GetErrno().c_str());
+      return false;
+    }
+  }
+}
+
+//reads up to frames samples from the file, and mixes them down to mono
+int CFileSource::ReadFrames(float* out, int frames)
+{
+  int framesize = m_channels * m_bytespersample;
+  if (m_datasize >= 0)
+    frames = Min(frames, (int)(m_datasize / framesize));
+
+  int nrframes = fread(&m_filebuf[0], framesize, frames, m_file);
+  if (m_datasize >= 0)
+    m_datasize -= nrframes * framesize;
+
+  const uint8_t* in = &m_filebuf[0];
+  const float    mul = 1.0f / m_channels;
+  for (int i = 0; i < nrframes; i++)
+  {
+    float sample = 0.0f;
+    for (int j = 0; j < m_channels; j++)
+    {
+      if (m_isfloat)
+      {
+        float value;
+        memcpy(&value, in, sizeof(value));
+        sample += value;
+      }
+      else if (m_bytespersample == 1)
+      {
+        sample += ((int)in[0] - 128) / 128.0f; //8 bit wav is unsigned
+      }
+      else
+      {
+        //shift the sample into the top bits of an int32, so the sign is correct
+        int32_t value = ReadLE(in, m_bytespersample) << (32 - m_bytespersample * 8);
+        sample += value / 2147483648.0f;
+      }
+
+      in += m_bytespersample;
+    }
+
+    out[i] = sample * mul;
+  }
+
+  return nrframes;
+}
+
+int CFileSource::GetAudio(float*& buf, int& samplerate, int64_t& audiotime)
+{
+  if (!m_connected)
+    return 0;
+
+  int frames = ReadFrames(&m_inbuf[0], BLOCKFRAMES);
+  if (frames <= 0)
+  {
+    Log("Reached end of \"%s\"", m_filename.c_str());
+    Disconnect();
+    m_finished = true;
+    return 0;
+  }
+
+  audiotime = m_starttime + m_inframes * 1000000LL / m_samplerate;
+  m_inframes += frames;
+
+  //in realtime mode, return the block when it would have been played back completely
+  if (m_realtime)
+    USleep(m_starttime + m_inframes * 1000000LL / m_samplerate - GetTimeUs());
+
+  samplerate = m_outsamplerate;
+
+  if (m_samplerate == m_outsamplerate)
+  {
+    buf = &m_inbuf[0];
+    return frames;
+  }
+
+  int outsamples = Round32((double)frames / m_samplerate * m_outsamplerate + 2.0);
+  if ((int)m_outbuf.size() < outsamples)
+    m_outbuf.resize(outsamples);
+
+  buf = &m_outbuf[0];
+
+  SRC_DATA srcdata = {};
+  srcdata.data_in = &m_inbuf[0];
+  srcdata.data_out = buf;
+  srcdata.input_frames = frames;
+  srcdata.output_frames = outsamples;
+  srcdata.src_ratio = (double)m_outsamplerate / m_samplerate;
+
+  src_process(m_srcstate, &srcdata);
+
+  return srcdata.output_frames_gen;
+}
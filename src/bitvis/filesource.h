@@ -0,0 +1,68 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILESOURCE_H
+#define FILESOURCE_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <samplerate.h>
+
+#include "audiosource.h"
+#include "util/inclstdint.h"
+
+//reads audio from a wav file, or from a raw file with signed 16 bit mono samples
+//in realtime mode the audio is delivered at the speed it would be played back,
+//otherwise it's delivered as fast as the consumer can process it
+class CFileSource : public CAudioSource
+{
+  public:
+    CFileSource(const std::string& filename, bool realtime, int rawsamplerate);
+    ~CFileSource();
+
+    bool Connect();
+    void Disconnect();
+    bool IsConnected() { return m_connected; }
+    int  GetAudio(float*& buf, int& samplerate, int64_t& audiotime);
+    bool Finished()    { return m_finished;  }
+
+  private:
+    bool ReadWavHeader();
+    int  ReadFrames(float* out, int frames);
+
+    std::string          m_filename;
+    bool                 m_realtime;
+    FILE*                m_file;
+    bool                 m_connected;
+    bool                 m_finished;
+    int                  m_samplerate;
+    int                  m_outsamplerate;
+    int                  m_channels;
+    int                  m_bytespersample;
+    bool                 m_isfloat;
+    int64_t              m_datasize;
+    int64_t              m_starttime;
+    int64_t              m_inframes;
+    SRC_STATE*           m_srcstate;
+    std::vector<uint8_t> m_filebuf;
+    std::vector<float>   m_inbuf;
+    std::vector<float>   m_outbuf;
+};
+
+#endif //FILESOURCE_H
@@ -29,32 +29,29 @@
 #include "util/misc.h"
 #include "util/timeutils.h"
 #include "util/log.h"
-#include "util/lock.h"
 
 #include "jackclient.h"
 #include "fft.h"
 
+//above this samplerate the audio is decimated by 2 until it's at or below it,
+//the analysis doesn't need more, and the fft resolution stays the same as at 44.1 or 48 KHz
+#define MAXANALYSISRATE 64000
+
 using namespace std;
 
 CJackClient::CJackClient()
 {
-  m_name          = "bitvis";
-  m_client        = NULL;
-  m_jackport      = NULL;
-  m_connected     = false;
-  m_wasconnected  = true;
-  m_exitstatus    = (jack_status_t)0;
-  m_samplerate    = 0;
-  m_outsamplerate = 40000;
-  m_srcstate      = NULL;
-
-  for (int i = 0; i < 2; i++)
-  {
-    m_buf[i]        = NULL;
-    m_bufsize[i]    = 0;
-    m_outsamples[i] = 0;
-    m_audiotime[i]  = 0;
-  }
+  m_name           = "bitvis";
+  m_client         = NULL;
+  m_jackport       = NULL;
+  m_connected      = false;
+  m_wasconnected   = true;
+  m_exitstatus     = (jack_status_t)0;
+  m_samplerate     = 0;
+  m_readsize       = 0;
+  m_capturelatency = 0;
+
+  sem_init(&m_semaphore, 0, 0);
 
   if (pipe2(m_pipe, O_NONBLOCK) == -1)
   {
@@ -71,6 +68,8 @@ CJackClient::~CJackClient()
     close(m_pipe[0]);
   if (m_pipe[1] != -1)
     close(m_pipe[1]);
+
+  sem_destroy(&m_semaphore);
 }
 
 bool CJackClient::Connect()
@@ -133,17 +132,29 @@ bool CJackClient::ConnectInternal()
     return false;
   }
 
-  //initialize the resampler
-  int error;
-  m_srcstate = src_new(SRC_SINC_FASTEST, 1, &error);
-
-  //alloc one second buffers
-  for (int i = 0; i < 2; i++)
+  //SJackLatencyCallback gets called when the latency of the input port changes
+  m_capturelatency = 0;
+  returnv = jack_set_latency_callback(m_client, SJackLatencyCallback, this);
+  if (returnv != 0)
   {
-    m_bufsize[i] = m_outsamplerate;
-    m_buf[i]     = (float*)malloc(m_bufsize[i] * sizeof(float));
+    LogError("Client \"%s\" error %i setting latency callback: \"%s\"",
+             m_name.c_str(), returnv, GetErrno().c_str());
+    return false;
   }
 
+  //the jack thread only copies samples at the jack samplerate,
+  //decimating happens in GetAudio(), outside the realtime thread
+  m_decimators.clear();
+  while ((m_samplerate >> m_decimators.size()) > MAXANALYSISRATE)
+    m_decimators.push_back(CDecimator());
+
+  if (!m_decimators.empty())
+    Log("Decimating the audio from %i to %i Hz", m_samplerate, m_samplerate >> m_decimators.size());
+
+  //alloc at least one second of buffer, with room for blocks of 16 frames
+  m_ringbuffer.Allocate(m_samplerate, m_samplerate / 16);
+  m_readsize = 0;
+
   //everything set up, activate
   returnv = jack_activate(m_client);
   if (returnv != 0)
@@ -179,18 +190,9 @@ void CJackClient::Disconnect()
   m_exitstatus = (jack_status_t)0;
   m_samplerate = 0;
 
-  for (int i = 0; i < 2; i++)
-  {
-    free(m_buf[i]);
-    m_buf[i] = NULL;
-    m_bufsize[i] = 0;
-  }
-
-  if (m_srcstate)
-  {
-    src_delete(m_srcstate);
-    m_srcstate = NULL;
-  }
+  m_ringbuffer.Free();
+  m_readsize = 0;
+  m_decimators.clear();
 }
 
 //returns true when the message has been sent or pipe is broken
@@ -248,101 +250,104 @@ int CJackClient::SJackProcessCallback(jack_nframes_t nframes, void *arg)
   return 0;
 }
 
+//this runs in the realtime jack thread, it never locks or logs,
+//samples are copied into the ring buffer and the consumer is woken up with a semaphore
 void CJackClient::PJackProcessCallback(jack_nframes_t nframes)
 {
-  int64_t now = GetTimeUs();
-  int outsamples = Round32((double)nframes / m_samplerate * m_outsamplerate + 2.0);
-
-  //use a trylock, so the realtime jack thread doesn't block
-  CLock lock(m_condition, true);
-
-  int index;
-  if (lock.HasLock())
+  //the first frame of this period arrived at the physical input the capture latency before the start of the period,
+  //jack's frame time is filtered against the soundcard clock, so this doesn't have the scheduling jitter of the callback
+  //jack_get_time() isn't necessarily the same clock as GetTimeUs(), so the time is moved over by their difference
+  int64_t        blocktime;
+  jack_nframes_t currentframes;
+  jack_time_t    currentusecs;
+  jack_time_t    nextusecs;
+  float          periodusecs;
+  if (jack_get_cycle_times(m_client, &currentframes, &currentusecs, &nextusecs, &periodusecs) == 0)
   {
-    //the mutex is locked, copy samples from the temp buffer into the main buffer
-    if (m_outsamples[1] > 0)
-    {
-      //if the main buffer is empty, use the time from the temp buffer
-      if (m_outsamples[0] == 0)
-        m_audiotime[0] = m_audiotime[1];
-
-      //copy as many samples as possible from the temp buffer to the main buffer
-      int size = Min(m_outsamples[1], m_bufsize[0] - m_outsamples[0]);
-      memcpy(m_buf[0] + m_outsamples[0], m_buf[1], size * sizeof(float));
-      m_outsamples[1] -= size;
-      m_outsamples[0] += size;
-    }
-
-    //if the main buffer has enough room, put the audio samples there
-    //otherwise put them into the temp buffer
-    if (m_bufsize[0] - m_outsamples[0] >= outsamples)
-      index = 0;
-    else
-      index = 1;
+    jack_nframes_t latency = __atomic_load_n(&m_capturelatency, __ATOMIC_RELAXED);
+    blocktime = (int64_t)jack_frames_to_time(m_client, currentframes - latency) - (int64_t)jack_get_time() + GetTimeUs();
   }
   else
   {
-    //the mutex couldn't be locked, copy samples into the temp buffer
-    index = 1;
+    blocktime = GetTimeUs();
   }
 
-  if (m_bufsize[index] - m_outsamples[index] < outsamples)
-    return; //no room, drop the samples
-
-  if (m_outsamples[index] == 0)
-    m_audiotime[index] = now;
-
-  float* jackptr = (float*)jack_port_get_buffer(m_jackport, nframes);
-
-  if (m_outsamplerate != m_samplerate)
+  float* span[2];
+  int    spansize[2];
+  if (m_ringbuffer.GetWriteSpans(span[0], spansize[0], span[1], spansize[1]) < (int)nframes)
   {
-    SRC_DATA srcdata = {};
-    srcdata.data_in = jackptr;
-    srcdata.data_out = m_buf[index] + m_outsamples[index];
-    srcdata.input_frames = nframes;
-    srcdata.output_frames = outsamples;
-    srcdata.src_ratio = (double)m_outsamplerate / m_samplerate;
-
-    src_process(m_srcstate, &srcdata);
-    m_outsamples[index] += srcdata.output_frames_gen;
-
-    if (srcdata.input_frames_used < (int)nframes)
-      Log("WARNING: %i out of %i frames used", (int)srcdata.input_frames_used, (int)nframes);
-  }
-  else
-  {
-    memcpy(m_buf[index] + m_outsamples[index], jackptr, nframes * sizeof(float));
-    m_outsamples[index] += nframes;
+    m_ringbuffer.Overrun(); //no room, drop the samples
+    return;
   }
 
-  lock.Leave();
-  m_condition.Signal();
+  //copy into the first span, and continue in the second one when the ring buffer wraps
+  float* jackptr = (float*)jack_port_get_buffer(m_jackport, nframes);
+  int    size    = Min((int)nframes, spansize[0]);
+  memcpy(span[0], jackptr, size * sizeof(float));
+  memcpy(span[1], jackptr + size, (nframes - size) * sizeof(float));
+
+  m_ringbuffer.CommitWrite(nframes, blocktime);
+  sem_post(&m_semaphore);
 }
 
-int CJackClient::GetAudio(float*& buf, int& bufsize, int& samplerate, int64_t& audiotime)
+//returns a span of samples, which stays valid until the next call,
+//either straight from the ring buffer, or from the last decimator
+int CJackClient::GetAudio(float*& buf, int& samplerate, int64_t& audiotime)
 {
-  CLock lock(m_condition);
-  m_condition.Wait(1000000, m_outsamples[0], 0);
+  //release the span returned by the previous call
+  m_ringbuffer.CommitRead(m_readsize);
+  m_readsize = 0;
 
-  if (m_outsamples[0] == 0)
-    return 0;
+  int64_t blocktime;
+  int     blockoffset;
+  int     samples = m_ringbuffer.GetReadSpan(buf, blocktime, blockoffset);
 
-  samplerate = m_outsamplerate;
+  if (samples == 0)
+  {
+    //wait up to a second for the jack thread to write a block
+    struct timespec timeout;
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec += 1;
+    while (sem_timedwait(&m_semaphore, &timeout) == -1 && errno == EINTR);
+
+    samples = m_ringbuffer.GetReadSpan(buf, blocktime, blockoffset);
+    if (samples == 0)
+      return 0;
+  }
 
-  if (bufsize < m_outsamples[0])
+  samplerate = m_samplerate;
+  audiotime  = blocktime + Round64((double)blockoffset * 1000000.0 / m_samplerate);
+  m_readsize = samples;
+
+  //every decimator halves the samplerate, and delays the audio by its lowpass
+  for (size_t i = 0; i < m_decimators.size() && samples > 0; i++)
   {
-    bufsize = m_outsamples[0];
-    buf = (float*)realloc(buf, bufsize * sizeof(float));
+    audiotime -= Round64((double)CDecimator::Delay() * 1000000.0 / samplerate);
+    samples = m_decimators[i].Process(buf, samples, buf);
+    samplerate /= 2;
   }
 
-  memcpy(buf, m_buf[0], m_outsamples[0] * sizeof(float));
+  return samples;
+}
 
-  int outsamples = m_outsamples[0];
-  m_outsamples[0] = 0;
+void CJackClient::SJackLatencyCallback(jack_latency_callback_mode_t mode, void *arg)
+{
+  ((CJackClient*)arg)->PJackLatencyCallback(mode);
+}
+
+//this runs in jack's notification thread, the capture latency of the input port
+//is how long ago the samples in the port buffer arrived at the physical input
+void CJackClient::PJackLatencyCallback(jack_latency_callback_mode_t mode)
+{
+  if (mode != JackCaptureLatency)
+    return;
 
-  audiotime = m_audiotime[0];
+  jack_latency_range_t range;
+  jack_port_get_latency_range(m_jackport, JackCaptureLatency, &range);
+  __atomic_store_n(&m_capturelatency, range.max, __ATOMIC_RELAXED);
 
-  return outsamples;
+  LogDebug("Client \"%s\" capture latency %u frames, %.1f ms",
+           m_name.c_str(), range.max, (double)range.max * 1000.0 / m_samplerate);
 }
 
 void CJackClient::SJackInfoShutdownCallback(jack_status_t code, const char *reason, void *arg)
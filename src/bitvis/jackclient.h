@@ -22,14 +22,16 @@
 #include <string>
 #include <vector>
 #include <jack/jack.h>
-#include <samplerate.h>
+#include <semaphore.h>
 
+#include "audiosource.h"
 #include "fft.h"
+#include "decimator.h"
 #include "clientmessage.h"
-#include "util/condition.h"
+#include "util/ringbuffer.h"
 #include "util/inclstdint.h"
 
-class CJackClient
+class CJackClient : public CAudioSource
 {
   public:
     CJackClient();
@@ -41,11 +43,11 @@ class CJackClient
     int  MsgPipe()     { return m_pipe[0];     }
     ClientMessage GetMessage();
 
-    jack_status_t      ExitStatus() { return m_exitstatus; }
-    const std::string& ExitReason() { return m_exitreason; }
+    int                ExitStatus() { return m_exitstatus; }
 
     int                Samplerate() { return m_samplerate; }
-    int                GetAudio(float*& buf, int& bufsize, int& samplerate, int64_t& audiotime);
+    int                GetAudio(float*& buf, int& samplerate, int64_t& audiotime);
+    int64_t            Overruns()   { return m_ringbuffer.Overruns(); }
 
   private:
     bool           m_connected;
@@ -54,17 +56,14 @@ class CJackClient
     jack_port_t*   m_jackport;
     std::string    m_name;
     int            m_samplerate;
-    int            m_outsamplerate;
     jack_status_t  m_exitstatus;
-    std::string    m_exitreason;
     int            m_portevents;
     int            m_pipe[2];
-    CCondition     m_condition;
-    float*         m_buf[2];
-    int            m_bufsize[2];
-    int            m_outsamples[2];
-    int64_t        m_audiotime[2];
-    SRC_STATE*     m_srcstate;
+    sem_t          m_semaphore;
+    CRingBuffer    m_ringbuffer;
+    int            m_readsize;
+    jack_nframes_t m_capturelatency; //frames from the physical input to the input port, set by jack
+    std::vector<CDecimator> m_decimators; //brings high samplerates down in the consumer thread
 
     bool        ConnectInternal();
     void        CheckMessages();
@@ -73,6 +72,9 @@ class CJackClient
     static int  SJackProcessCallback(jack_nframes_t nframes, void *arg);
     void        PJackProcessCallback(jack_nframes_t nframes);
 
+    static void SJackLatencyCallback(jack_latency_callback_mode_t mode, void *arg);
+    void        PJackLatencyCallback(jack_latency_callback_mode_t mode);
+
     static void SJackInfoShutdownCallback(jack_status_t code, const char *reason, void *arg);
     void        PJackInfoShutdownCallback(jack_status_t code, const char *reason);
 };
@@ -1,6 +1,6 @@
 #include <cstdio>
 #include <cstring>
-#include <sstream>
+#include <cstdlib>
 #include <uriparser/Uri.h>
 
 #include "mpdclient.h"
@@ -11,241 +11,390 @@
 
 using namespace std;
 
+//time between connection attempts
+#define RECONNECTINTERVAL 10000000
+
+//longest wait for connecting, and for the response to a command
+#define RESPONSETIMEOUT 10000000
+
+//idle is interrupted this often, to find out if mpd is still there
+#define IDLECHECKINTERVAL 30000000
+
 CMpdClient::CMpdClient(std::string address, int port)
 {
   m_port = port;
   m_address = address;
-  m_isplaying = false;
-  m_playingchanged = false;
-  m_volume = 0;
-  m_volumechanged = false;
-  m_elapsedstate = 0.0;
+  m_state.songversion = 0;
+  m_state.playingversion = 0;
+  m_state.volumeversion = 0;
+  m_state.isplaying = false;
+  m_state.volume = 0;
+  m_state.elapsed = 0.0;
+  m_state.total = 0.0;
+  m_state.elapsedtime = 0;
+  m_state.extrapolate = false;
+  m_published = m_state;
+  m_sequence = 0;
+  m_eventloop = NULL;
+  m_sockstate = StateStopped;
+  m_changed = false;
 }
 
 CMpdClient::~CMpdClient()
 {
+  Stop();
 }
 
-void CMpdClient::Process()
+void CMpdClient::Setup(CEventLoop* eventloop)
 {
-  while (!m_stop)
-  {
-    if (!m_socket.IsOpen())
-    {
-      if (!OpenSocket())
-        continue;
-    }
+  m_eventloop = eventloop;
 
-    if (!GetCurrentSong() || !GetPlayStatus())
-    {
-      m_socket.Close();
-      USleep(10000000, &m_stop);
-    }
-    else
-    {
-      USleep(30000);
-    }
+  //the host is only looked up here, a slow lookup in the event loop would delay the frames
+  if (m_socket.Resolve(m_address, m_port) != SUCCESS)
+  {
+    SetError(m_socket.GetError());
+    LogError("Looking up %s:%i, %s", m_address.c_str(), m_port, m_socket.GetError().c_str());
   }
+}
 
-  m_socket.Close();
+void CMpdClient::Start()
+{
+  if (m_sockstate == StateStopped)
+    Connect();
 }
 
-bool CMpdClient::OpenSocket()
+void CMpdClient::Stop()
 {
-  m_socket.Close();
-  int returnv = m_socket.Open(m_address, m_port, 10000000);
+  if (m_sockstate != StateStopped)
+    Disconnect(false);
+}
+
+void CMpdClient::Connect()
+{
+  m_parser.Clear();
 
-  if (returnv != SUCCESS)
+  if (m_socket.OpenNonBlock() != SUCCESS)
   {
-    SetSockError();
+    SetError(m_socket.GetError());
     LogError("Connecting to %s:%i, %s", m_address.c_str(), m_port, m_socket.GetError().c_str());
-    m_socket.Close();
+    Disconnect(true);
+    return;
+  }
 
-    if (returnv != TIMEOUT)
-      USleep(10000000, &m_stop);
+  //the socket becomes writeable when the connect finished, or failed
+  m_sockstate = StateConnecting;
+  m_eventloop->Add(m_socket.GetSock(), EPOLLOUT, this);
+  m_eventloop->SetTimer(this, GetTimeUs() + RESPONSETIMEOUT);
+}
 
-    return false;
+//tries the next address of the host right away, when all of them failed it waits for the reconnect timer
+void CMpdClient::ConnectFailed()
+{
+  if (m_socket.NextAddress())
+  {
+    m_eventloop->Remove(m_socket.GetSock());
+    m_eventloop->ClearTimer(this);
+    Connect();
   }
   else
   {
-    Log("Connected to %s:%i", m_address.c_str(), m_port);
-    SetCurrentSong("Connected to " + m_address + " " + ToString(m_port));
-    return true;
+    Disconnect(true);
   }
 }
 
-bool CMpdClient::GetCurrentSong()
+void CMpdClient::Disconnect(bool reconnect)
 {
-  CTcpData data;
-  data.SetData("currentsong\n");
-  if (m_socket.Write(data) != SUCCESS)
+  if (m_socket.IsOpen())
   {
-    SetSockError();
-    LogError("Writing socket: %s", m_socket.GetError().c_str());
-    return false;
+    m_eventloop->Remove(m_socket.GetSock());
+    m_socket.Close();
   }
 
-  string artist;
-  string title;
-  string file;
+  m_eventloop->ClearTimer(this);
 
-  data.Clear();
-  while(1)
+  if (reconnect)
+  {
+    m_sockstate = StateWaiting;
+    m_eventloop->SetTimer(this, GetTimeUs() + RECONNECTINTERVAL);
+  }
+  else
+  {
+    m_sockstate = StateStopped;
+  }
+}
+
+void CMpdClient::OnEvent(uint32_t events)
+{
+  if (m_sockstate == StateConnecting)
   {
-    if (m_socket.Read(data) != SUCCESS)
+    if (m_socket.FinishConnect() != SUCCESS)
     {
-      SetSockError();
-      LogError("Reading socket: %s", m_socket.GetError().c_str());
-      return false;
+      SetError(m_socket.GetError());
+      LogError("Connecting to %s:%i, %s", m_address.c_str(), m_port, m_socket.GetError().c_str());
+      ConnectFailed();
+      return;
     }
 
-    stringstream datastream(data.GetData());
-    string line;
-    while (1)
-    {
-      getline(datastream, line);
-      if (datastream.fail())
-        break;
+    Log("Connected to %s:%i", m_address.c_str(), m_port);
+    SetCurrentSong("Connected to " + m_address + " " + ToString(m_port));
 
-      string tmpline = line;
-      string word;
-      if (GetWord(tmpline, word))
-      {
-        if (word == "Artist:")
-          artist = tmpline.substr(1);
-        else if (word == "Title:")
-          title = tmpline.substr(1);
-        else if (word == "file:")
-          file = StripFilename(tmpline.substr(1));
-      }
+    //mpd starts with a "OK MPD <version>" line
+    m_sockstate = StateGreeting;
+    m_eventloop->Modify(m_socket.GetSock(), EPOLLIN, this);
+    m_eventloop->SetTimer(this, GetTimeUs() + RESPONSETIMEOUT);
+    return;
+  }
 
-      if (line == "OK")
-      {
-        string songtext;
-        if (artist.empty() || title.empty())
-          songtext = file;
-        else
-          songtext = artist + " - " + title;
-
-        SetCurrentSong(songtext);
-        return true;
-      }
-    }
+  //the socket is readable, or closed, read returns the error then
+  if (m_socket.Read(m_readdata) != SUCCESS)
+  {
+    SetError(m_socket.GetError());
+    LogError("Reading socket: %s", m_socket.GetError().c_str());
+    Disconnect(true);
+    return;
   }
 
-  SetCurrentSong("Unable to get song info");
-  return false;
+  m_parser.Feed(m_readdata.GetData(), m_readdata.GetSize());
+
+  //a line can disconnect, then the rest is from the old connection
+  CMpdParser::LineType type;
+  CMpdParser::field    line;
+  while (m_sockstate >= StateGreeting && (type = m_parser.Next(line)) != CMpdParser::LineNone)
+    HandleLine(type, line);
+}
+
+void CMpdClient::OnTimer()
+{
+  if (m_sockstate == StateWaiting)
+  {
+    Connect();
+  }
+  else if (m_sockstate == StateIdle)
+  {
+    //noidle makes mpd end the idle command, when that isn't answered in time the connection is dead,
+    //mpd ignores it when idle had just ended
+    SendCommand("noidle\n", StateNoIdle);
+  }
+  else if (m_sockstate == StateConnecting)
+  {
+    SetError(m_address + ":" + ToString(m_port) + " timed out");
+    LogError("Timed out connecting to %s:%i", m_address.c_str(), m_port);
+    ConnectFailed();
+  }
+  else if (m_sockstate != StateStopped)
+  {
+    SetError(m_address + ":" + ToString(m_port) + " timed out");
+    LogError("Timed out waiting for %s:%i", m_address.c_str(), m_port);
+    Disconnect(true);
+  }
 }
 
-bool CMpdClient::GetPlayStatus()
+//sends a command, and waits for its response in the given state,
+//commands are only sent when the previous response is complete, so they always fit in the socket buffer
+bool CMpdClient::SendCommand(const char* command, State state)
 {
-  CTcpData data;
-  data.SetData("status\n");
-  if (m_socket.Write(data) != SUCCESS)
+  struct iovec iov;
+  iov.iov_base = (void*)command;
+  iov.iov_len = strlen(command);
+
+  int byteswritten;
+  if (m_socket.TryWrite(&iov, 1, byteswritten) != SUCCESS || byteswritten != (int)iov.iov_len)
   {
-    SetSockError();
+    SetError(m_socket.GetError());
     LogError("Writing socket: %s", m_socket.GetError().c_str());
+    Disconnect(true);
     return false;
   }
 
-  data.Clear();
-  bool   isplaying = false;
-  int    volume = -1;
-  double elapsed = -1.0;
-  double total = 0.0;
-  while(1)
+  m_sockstate = state;
+
+  //idle waits for as long as nothing changes, but not longer than the check interval
+  if (state == StateIdle)
+    m_eventloop->SetTimer(this, GetTimeUs() + IDLECHECKINTERVAL);
+  else
+    m_eventloop->SetTimer(this, GetTimeUs() + RESPONSETIMEOUT);
+
+  return true;
+}
+
+//after connecting, the current song and the status are requested,
+//then mpd's idle command is used to wait until the player or the mixer changed, instead of polling,
+//the elapsed time of the song is extrapolated locally between the updates
+void CMpdClient::HandleLine(CMpdParser::LineType type, CMpdParser::field& line)
+{
+  if (m_sockstate == StateGreeting)
   {
-    if (m_socket.Read(data) != SUCCESS)
+    if (type == CMpdParser::LineOK)
     {
-      SetSockError();
-      LogError("Reading socket: %s", m_socket.GetError().c_str());
-      return false;
+      SendCommand("currentsong\n", StateCurrentSong);
     }
-
-    stringstream datastream(data.GetData());
-    string line;
-    while (1)
+    else if (type == CMpdParser::LineAck)
     {
-      getline(datastream, line);
-      if (datastream.fail())
-        break;
+      SetError(line.value);
+      LogError("Connecting to %s:%i, %s", m_address.c_str(), m_port, line.value);
+      Disconnect(true);
+    }
+  }
+  else if (m_sockstate == StateCurrentSong)
+  {
+    HandleCurrentSong(type, line);
+  }
+  else if (m_sockstate == StateStatus)
+  {
+    HandleStatus(type, line);
+  }
+  else if (m_sockstate == StateIdle || m_sockstate == StateNoIdle)
+  {
+    HandleIdle(type, line);
+  }
+}
+
+void CMpdClient::HandleCurrentSong(CMpdParser::LineType type, CMpdParser::field& line)
+{
+  if (type == CMpdParser::LineKeyValue)
+  {
+    if (line.KeyIs("Artist"))
+      m_artist.assign(line.value, line.valuelen);
+    else if (line.KeyIs("Title"))
+      m_title.assign(line.value, line.valuelen);
+    else if (line.KeyIs("file"))
+      m_file.assign(line.value, line.valuelen);
+  }
+  else if (type == CMpdParser::LineOK)
+  {
+    if (m_artist.empty() || m_title.empty())
+      SetCurrentSong(StripFilename(m_file));
+    else
+      SetCurrentSong(m_artist + " - " + m_title);
 
-      string tmpline = line;
-      string word;
-      if (GetWord(tmpline, word))
+    m_artist.clear();
+    m_title.clear();
+    m_file.clear();
+
+    m_status.isplaying = false;
+    m_status.volume = -1;
+    m_status.elapsed = -1.0;
+    m_status.total = 0.0;
+    SendCommand("status\n", StateStatus);
+  }
+  else if (type == CMpdParser::LineAck)
+  {
+    LogError("currentsong failed: %s", line.value);
+    m_artist.clear();
+    m_title.clear();
+    m_file.clear();
+    SetError("Unable to get song info");
+    Disconnect(true);
+  }
+}
+
+void CMpdClient::HandleStatus(CMpdParser::LineType type, CMpdParser::field& line)
+{
+  if (type == CMpdParser::LineKeyValue)
+  {
+    char* end;
+    if (line.KeyIs("state"))
+    {
+      m_status.isplaying = strcmp(line.value, "play") == 0;
+    }
+    else if (line.KeyIs("volume"))
+    {
+      long parsevolume = strtol(line.value, &end, 10);
+      if (end != line.value)
+        m_status.volume = parsevolume;
+    }
+    else if (line.KeyIs("time"))
+    {
+      //elapsed:total in whole seconds
+      double tmpelapsed = strtod(line.value, &end);
+      if (end != line.value && *end == ':')
       {
-        if (word == "state:")
-        {
-          if (GetWord(tmpline, word))
-            if (word == "play")
-              isplaying = true;
-        }
-        else if (word == "volume:")
-        {
-          int parsevolume;
-          if (GetWord(tmpline, word) && StrToInt(word, parsevolume))
-            volume = parsevolume;
-        }
-        else if (word == "time:")
-        {
-          if (GetWord(tmpline, word))
-          {
-            size_t colon = word.find(':');
-            if (colon != string::npos && colon > 0 && colon < word.size() - 1)
-            {
-              double tmpelapsed;
-              double tmptotal;
-
-              if (elapsed < 0.0 && StrToFloat(word.substr(0, colon), tmpelapsed))
-                elapsed = tmpelapsed;
-
-              if (StrToFloat(word.substr(colon + 1), tmptotal) && tmptotal > 0.0)
-                total = tmptotal;
-            }
-          }
-        }
-        else if (word == "elapsed:")
+        const char* totalstr = end + 1;
+        double tmptotal = strtod(totalstr, &end);
+
+        if (end != totalstr && tmptotal > 0.0)
         {
-          if (GetWord(tmpline, word))
-          {
-            double tmpelapsed;
-            if (StrToFloat(word, tmpelapsed))
-              elapsed = tmpelapsed;
-          }
+          if (m_status.elapsed < 0.0)
+            m_status.elapsed = tmpelapsed;
+          m_status.total = tmptotal;
         }
       }
+    }
+    else if (line.KeyIs("elapsed"))
+    {
+      double tmpelapsed = strtod(line.value, &end);
+      if (end != line.value)
+        m_status.elapsed = tmpelapsed;
+    }
+  }
+  else if (type == CMpdParser::LineOK)
+  {
+    bool isplaying = m_status.isplaying;
 
-      if (line == "OK")
-      {
-        if (volume == 0)
-          isplaying = false;
+    //the elapsed time advances while playing, even when the volume is 0
+    m_state.extrapolate = isplaying;
 
-        CLock lock(m_condition);
-        if (m_isplaying == false && isplaying == true)
-          m_playingchanged = true;
+    if (m_status.volume == 0)
+      isplaying = false;
 
-        m_isplaying = isplaying;
+    if (m_state.isplaying == false && isplaying == true)
+      m_state.playingversion++;
 
-        if (volume != -1 && m_volume != volume)
-        {
-          m_volume = volume;
-          m_volumechanged = true;
-        }
+    m_state.isplaying = isplaying;
 
-        if (total > 0.0 && elapsed >= 0.0)
-          m_elapsedstate = elapsed / total;
-        else
-          m_elapsedstate = 0.0;
+    if (m_status.volume != -1 && m_state.volume != m_status.volume)
+    {
+      m_state.volume = m_status.volume;
+      m_state.volumeversion++;
+    }
 
-        return true;
-      }
+    if (m_status.total > 0.0 && m_status.elapsed >= 0.0)
+    {
+      m_state.elapsed = m_status.elapsed;
+      m_state.total = m_status.total;
     }
-  }
+    else
+    {
+      m_state.elapsed = 0.0;
+      m_state.total = 0.0;
+      m_state.extrapolate = false;
+    }
+    m_state.elapsedtime = GetTimeUs();
 
-  SetCurrentSong("Unable to get play status");
-  m_isplaying = true; //to make the error message show on the led display
+    PublishState();
 
-  return false;
+    m_changed = false;
+    SendCommand("idle player mixer\n", StateIdle);
+  }
+  else if (type == CMpdParser::LineAck)
+  {
+    LogError("status failed: %s", line.value);
+    SetError("Unable to get play status");
+    Disconnect(true);
+  }
+}
+
+//idle returns when the player or the mixer changed, then the song and status are requested again
+void CMpdClient::HandleIdle(CMpdParser::LineType type, CMpdParser::field& line)
+{
+  if (type == CMpdParser::LineKeyValue)
+  {
+    if (line.KeyIs("changed"))
+      m_changed = true;
+  }
+  else if (type == CMpdParser::LineOK)
+  {
+    if (m_changed)
+      SendCommand("currentsong\n", StateCurrentSong);
+    else
+      SendCommand("idle player mixer\n", StateIdle);
+  }
+  else if (type == CMpdParser::LineAck)
+  {
+    LogError("idle failed: %s", line.value);
+    SetError("Unable to wait for mpd changes");
+    Disconnect(true);
+  }
 }
 
 void CMpdClient::SetCurrentSong(const std::string& song)
@@ -254,49 +403,65 @@ void CMpdClient::SetCurrentSong(const std::string& song)
   if (song != m_currentsong)
   {
     m_currentsong = song;
-    m_songchanged = true;
-
+    m_state.songversion++;
+    PublishState();
     lock.Leave();
+
     Log("Song changed to \"%s\"", song.c_str());
   }
 }
 
-void CMpdClient::SetSockError()
+void CMpdClient::SetError(const std::string& error)
 {
-  SetCurrentSong(m_socket.GetError());
-  m_isplaying = true; //to make the error message show on the led display
+  SetCurrentSong(error);
+  m_state.isplaying = true; //to make the error message show on the led display
+  PublishState();
 }
 
-bool CMpdClient::CurrentSong(std::string& song)
+//seqlock, m_sequence is odd while m_published is written, readers retry when it was odd or changed
+void CMpdClient::PublishState()
 {
-  CLock lock(m_condition);
-  song = m_currentsong;
-  bool songchanged = m_songchanged;
-  m_songchanged = false;
-  return songchanged;
+  __atomic_store_n(&m_sequence, m_sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  m_published = m_state;
+
+  __atomic_store_n(&m_sequence, m_sequence + 1, __ATOMIC_RELEASE);
 }
 
-bool CMpdClient::IsPlaying(bool& playingchanged)
+void CMpdClient::GetState(state& mpdstate)
 {
-  CLock lock(m_condition);
-  playingchanged = m_playingchanged;
-  m_playingchanged = false;
-  return m_isplaying;
+  uint32_t sequence;
+  do
+  {
+    sequence = __atomic_load_n(&m_sequence, __ATOMIC_ACQUIRE);
+    mpdstate = m_published;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+  while ((sequence & 1) || sequence != __atomic_load_n(&m_sequence, __ATOMIC_RELAXED));
 }
 
-bool CMpdClient::GetVolume(int& volume)
+uint32_t CMpdClient::CurrentSong(std::string& song)
 {
   CLock lock(m_condition);
-  volume = m_volume;
-  bool changed = m_volumechanged;
-  m_volumechanged = false;
-  return changed;
+  song = m_currentsong;
+
+  //the song and its version are published together with m_condition held
+  state mpdstate;
+  GetState(mpdstate);
+  return mpdstate.songversion;
 }
 
-double CMpdClient::GetElapsedState()
+double CMpdClient::ElapsedState(const state& mpdstate)
 {
-  CLock lock(m_condition);
-  return m_elapsedstate;
+  if (mpdstate.total <= 0.0)
+    return 0.0;
+
+  double elapsed = mpdstate.elapsed;
+  if (mpdstate.extrapolate)
+    elapsed += (double)(GetTimeUs() - mpdstate.elapsedtime) / 1000000.0;
+
+  return Min(elapsed / mpdstate.total, 1.0);
 }
 
 std::string CMpdClient::StripFilename(const std::string& filename)
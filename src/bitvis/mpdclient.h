@@ -4,41 +4,103 @@
 #include <deque>
 #include <string>
 
-#include "util/thread.h"
 #include "util/condition.h"
 #include "util/tcpsocket.h"
+#include "util/eventloop.h"
+#include "mpdparser.h"
 
-class CMpdClient : public CThread
+//mpd client driven by a CEventLoop, connecting and reading never block,
+//commands are sent one at a time, and the response is handled as it comes in
+class CMpdClient : public CEventHandler
 {
   public:
     CMpdClient(std::string address, int port);
     ~CMpdClient();
 
-    virtual void Process();
-    bool CurrentSong(std::string& song);
-    bool IsPlaying(bool& playingchanged);
-    bool GetVolume(int& volume);
-    double GetElapsedState();
+    //state of mpd, the versions increase when the song changed, playing started, or the volume changed
+    struct state
+    {
+      uint32_t songversion;
+      uint32_t playingversion;
+      uint32_t volumeversion;
+      bool     isplaying;
+      int      volume;
+      double   elapsed;     //seconds played, at elapsedtime
+      double   total;       //length of the song in seconds
+      int64_t  elapsedtime;
+      bool     extrapolate; //true when mpd is playing, so elapsed time advances
+    };
+
+    //Start() and Stop() have to be called from the thread that runs the event loop
+    void   Setup(CEventLoop* eventloop);
+    void   Start();
+    void   Stop();
+
+    virtual void OnEvent(uint32_t events);
+    virtual void OnTimer();
+
+    //reads the state published by the event loop thread, this never blocks,
+    //it only retries when the event loop thread is publishing at the same moment
+    void   GetState(state& mpdstate);
+
+    //copies the song text, only needed when songversion changed, returns its version
+    uint32_t CurrentSong(std::string& song);
+
+    //elapsed part of the song from 0.0 to 1.0, extrapolated from the last status
+    static double ElapsedState(const state& mpdstate);
 
   private:
-    bool         OpenSocket();
-    bool         GetCurrentSong();
-    bool         GetPlayStatus();
+    enum State
+    {
+      StateStopped,
+      StateWaiting,     //waiting for the reconnect timer
+      StateConnecting,
+      StateGreeting,    //waiting for "OK MPD <version>"
+      StateCurrentSong, //waiting for the response of the commands below
+      StateStatus,
+      StateIdle,
+      StateNoIdle,      //idle was interrupted with noidle, waiting for its response
+    };
+
+    void         Connect();
+    void         ConnectFailed();
+    void         Disconnect(bool reconnect);
+    bool         SendCommand(const char* command, State state);
+    void         HandleLine(CMpdParser::LineType type, CMpdParser::field& line);
+    void         HandleCurrentSong(CMpdParser::LineType type, CMpdParser::field& line);
+    void         HandleStatus(CMpdParser::LineType type, CMpdParser::field& line);
+    void         HandleIdle(CMpdParser::LineType type, CMpdParser::field& line);
     void         SetCurrentSong(const std::string& song);
-    void         SetSockError();
+    void         SetError(const std::string& error);
+    void         PublishState();
     std::string  StripFilename(const std::string& filename);
 
+    //the status response, collected until its OK
+    struct status
+    {
+      bool   isplaying;
+      int    volume;
+      double elapsed;
+      double total;
+    };
+
     int              m_port;
     std::string      m_address;
     CTcpClientSocket m_socket;
-    CCondition       m_condition;
+    CEventLoop*      m_eventloop;
+    State            m_sockstate;
+    CTcpData         m_readdata;
+    CMpdParser       m_parser;
+    status           m_status;
+    bool             m_changed;     //set when idle reported a change
+    std::string      m_artist;
+    std::string      m_title;
+    std::string      m_file;
+    CCondition       m_condition;   //only protects m_currentsong
     std::string      m_currentsong;
-    bool             m_songchanged;
-    bool             m_isplaying;
-    bool             m_playingchanged;
-    int              m_volume;
-    bool             m_volumechanged;
-    double           m_elapsedstate;
+    state            m_state;       //only used by the event loop thread
+    state            m_published;   //copy of m_state for the readers, protected by m_sequence
+    uint32_t         m_sequence;    //odd while m_published is being written
 };
 
 
@@ -0,0 +1,256 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mpdparser.h"
+#include "util/log.h"
+#include "util/timeutils.h"
+#include "util/misc.h"
+
+CMpdParser::CMpdParser()
+{
+  m_start = 0;
+  m_end = 0;
+}
+
+void CMpdParser::Feed(const char* data, int size)
+{
+  //data can be NULL when there's nothing, and m_buf might be empty
+  if (size <= 0)
+    return;
+
+  //move the partial line to the front, the parsed lines aren't needed anymore
+  if (m_start > 0)
+  {
+    memmove(&m_buf[0], &m_buf[m_start], m_end - m_start);
+    m_end -= m_start;
+    m_start = 0;
+  }
+
+  if (m_end + size > (int)m_buf.size())
+    m_buf.resize(m_end + size);
+
+  memcpy(&m_buf[m_end], data, size);
+  m_end += size;
+}
+
+void CMpdParser::Clear()
+{
+  m_start = 0;
+  m_end = 0;
+}
+
+CMpdParser::LineType CMpdParser::Next(field& line)
+{
+  if (m_start == m_end)
+    return LineNone;
+
+  char* start = &m_buf[m_start];
+  char* newline = (char*)memchr(start, '\n', m_end - m_start);
+  if (!newline)
+    return LineNone;
+
+  *newline = 0;
+  m_start += newline - start + 1;
+
+  if (strncmp(start, "OK", 2) == 0 && (start[2] == 0 || start[2] == ' '))
+  {
+    line.key = start;
+    line.keylen = 2;
+    line.value = start + 2;
+    line.valuelen = newline - line.value;
+    return LineOK;
+  }
+  else if (strncmp(start, "ACK", 3) == 0)
+  {
+    line.key = start;
+    line.keylen = 3;
+    line.value = start;
+    line.valuelen = newline - start;
+    return LineAck;
+  }
+
+  //the key ends at ": ", a line without it has an empty value
+  char* colon = strstr(start, ": ");
+  line.key = start;
+  if (colon)
+  {
+    line.keylen = colon - start;
+    line.value = colon + 2;
+  }
+  else
+  {
+    line.keylen = newline - start;
+    line.value = newline;
+  }
+  line.valuelen = newline - line.value;
+
+  return LineKeyValue;
+}
+
+//parses data fed in fragments of a fixed size, after a first part of split bytes,
+//every line is stored as its type, key and value
+void CMpdParser::ParseFragments(const char* data, int size, int fragment, int split, std::vector<std::string>& lines)
+{
+  CMpdParser parser;
+  field      line;
+  LineType   type;
+
+  lines.clear();
+
+  int pos = 0;
+  while (pos < size)
+  {
+    int feedsize = pos == 0 && split > 0 ? split : fragment;
+    if (pos + feedsize > size)
+      feedsize = size - pos;
+
+    parser.Feed(data + pos, feedsize);
+    pos += feedsize;
+
+    while ((type = parser.Next(line)) != LineNone)
+    {
+      std::string str = ToString((int)type) + " [" + std::string(line.key, line.keylen) + "] [" + line.value + "]";
+      if ((int)strlen(line.value) != line.valuelen)
+        str += " wrong value length";
+
+      lines.push_back(str);
+    }
+  }
+}
+
+bool CMpdParser::SelfCheck()
+{
+  //the greeting, key value lines, a value with ": " in it, an empty value, a line without ": ",
+  //the end of a response and an error
+  const char* response =
+    "OK MPD 0.23.5\n"
+    "file: music/07%20Some%20Title.flac\nTitle: Some: Title\nArtist: \nchanged\nOK\n"
+    "volume: 80\nstate: play\nOK\n"
+    "ACK [50@0] {play} No such song\n"
+    "OKAY: not the end\nOK\n";
+
+  //type, key and value of every line, as ParseFragments() stores them
+  const char* expected[] =
+  {
+    "2 [OK] [ MPD 0.23.5]",
+    "1 [file] [music/07%20Some%20Title.flac]",
+    "1 [Title] [Some: Title]",
+    "1 [Artist] []",
+    "1 [changed] []",
+    "2 [OK] []",
+    "1 [volume] [80]",
+    "1 [state] [play]",
+    "2 [OK] []",
+    "3 [ACK] [ACK [50@0] {play} No such song]",
+    "1 [OKAY] [not the end]",
+    "2 [OK] []",
+  };
+
+  const int size = strlen(response);
+  const int nrexpected = sizeof(expected) / sizeof(expected[0]);
+
+  //in one piece
+  std::vector<std::string> reference;
+  ParseFragments(response, size, size, 0, reference);
+
+  bool ok = (int)reference.size() == nrexpected;
+  for (int i = 0; i < nrexpected && ok; i++)
+    ok = reference[i] == expected[i];
+
+  if (!ok)
+  {
+    for (size_t i = 0; i < reference.size(); i++)
+      LogError("mpd parser self check: line %i is \"%s\"", (int)i, reference[i].c_str());
+
+    LogError("mpd parser self check: parsing the response in one piece didn't give the expected %i lines", nrexpected);
+    return false;
+  }
+
+  //fragments of every size, then two parts split at every byte, which splits every line at ": " and at the newline
+  std::vector<std::string> lines;
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (int i = 1; i < size; i++)
+    {
+      if (pass == 0)
+        ParseFragments(response, size, i, 0, lines);
+      else
+        ParseFragments(response, size, size, i, lines);
+
+      for (size_t j = 0; j < Max(lines.size(), reference.size()); j++)
+      {
+        const char* got      = j < lines.size()     ? lines[j].c_str()     : "nothing";
+        const char* expected = j < reference.size() ? reference[j].c_str() : "nothing";
+        if (strcmp(got, expected) != 0)
+        {
+          LogError("mpd parser self check: %s %i, line %i is \"%s\", expected \"%s\"",
+                   pass == 0 ? "fragments of" : "split at", i, (int)j, got, expected);
+          ok = false;
+        }
+      }
+    }
+  }
+
+  if (ok)
+    Log("mpd parser self check passed, %i lines in fragments of 1 to %i bytes and split at every byte",
+        (int)reference.size(), size - 1);
+
+  return ok;
+}
+
+//parses a typical status and currentsong response, fed in small fragments like a slow socket would
+void CMpdParser::Benchmark()
+{
+  const char* response =
+    "volume: 80\nrepeat: 0\nrandom: 1\nsingle: 0\nconsume: 0\nplaylist: 42\nplaylistlength: 1234\n"
+    "mixrampdb: 0.000000\nstate: play\nsong: 17\nsongid: 18\ntime: 71:245\nelapsed: 70.823\n"
+    "bitrate: 320\nduration: 245.472\naudio: 44100:24:2\nnextsong: 18\nnextsongid: 19\nOK\n"
+    "file: music/Some%20Artist/Some%20Album/07%20Some%20Title.flac\n"
+    "Last-Modified: 2012-06-01T12:00:00Z\nTime: 245\nduration: 245.472\nArtist: Some Artist\n"
+    "Title: Some Title\nAlbum: Some Album\nTrack: 7\nDate: 2012\nGenre: Electronic\nPos: 17\nId: 18\nOK\n";
+
+  const int size = strlen(response);
+  const int fragmentsizes[] = { 7, 100, 1000 };
+  const int nrresponses = 100000;
+
+  for (size_t i = 0; i < sizeof(fragmentsizes) / sizeof(fragmentsizes[0]); i++)
+  {
+    CMpdParser parser;
+    field      line;
+    int64_t    lines = 0;
+
+    int64_t start = GetThreadCpuTimeUs();
+    for (int j = 0; j < nrresponses; j++)
+    {
+      for (int pos = 0; pos < size; pos += fragmentsizes[i])
+      {
+        int fragment = fragmentsizes[i];
+        if (pos + fragment > size)
+          fragment = size - pos;
+
+        parser.Feed(response + pos, fragment);
+        while (parser.Next(line) != LineNone)
+          lines++;
+      }
+    }
+    int64_t parsetime = Max(GetThreadCpuTimeUs() - start, (int64_t)1);
+
+    Log("Benchmark: mpd parser in fragments of %4i bytes: %.1f MB/s, %.2f million lines/s",
+        fragmentsizes[i], (double)size * nrresponses / parsetime, (double)lines / parsetime);
+  }
+}
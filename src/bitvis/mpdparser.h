@@ -0,0 +1,74 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPDPARSER_H
+#define MPDPARSER_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "util/inclstdint.h"
+
+//splits mpd responses into "key: value" lines, data can be fed in any fragments,
+//lines are parsed in place in a receive buffer that is reused, so after the buffer
+//has grown to the largest response, nothing is allocated
+class CMpdParser
+{
+  public:
+    enum LineType
+    {
+      LineNone,     //need more data
+      LineKeyValue,
+      LineOK,       //end of a response, or the greeting
+      LineAck,      //error, the whole line is in value
+    };
+
+    //points into the receive buffer, valid until the next call to Feed() or Clear()
+    struct field
+    {
+      const char* key;
+      int         keylen;
+      const char* value;    //null terminated
+      int         valuelen;
+
+      bool KeyIs(const char* str) const { return strncmp(key, str, keylen) == 0 && str[keylen] == 0; }
+    };
+
+    CMpdParser();
+
+    void     Feed(const char* data, int size);
+    void     Clear();
+
+    //parses the next complete line, returns LineNone when there is none yet
+    LineType Next(field& line);
+
+    //feeds a canned response in fragments of every size, and in two parts split at every byte,
+    //logs every line that differs from parsing it in one piece, returns false when any did
+    static bool SelfCheck();
+    static void Benchmark();
+
+  private:
+    static void ParseFragments(const char* data, int size, int fragment, int split, std::vector<std::string>& lines);
+
+    std::vector<char> m_buf;
+    int               m_start; //first byte that wasn't parsed
+    int               m_end;   //end of the received data
+};
+
+#endif //MPDPARSER_H
@@ -0,0 +1,283 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multiresfft.h"
+#include "util/misc.h"
+#include "util/log.h"
+#include "util/timeutils.h"
+
+CMultiResFft::CMultiResFft()
+{
+  m_nrstages = 0;
+  m_stages = NULL;
+  m_fftsize = 0;
+  m_samplerate = 0;
+  m_reffftsize = 0;
+  m_nrcolumns = 0;
+  m_scale = ScaleQuadratic;
+}
+
+CMultiResFft::~CMultiResFft()
+{
+  Free();
+}
+
+void CMultiResFft::Allocate(int nrstages, unsigned int fftsize, unsigned int hop, WindowType window)
+{
+  Free();
+
+  m_nrstages = nrstages;
+  m_fftsize = fftsize;
+  m_stages = new stage[m_nrstages + 1];
+
+  for (int i = 0; i <= m_nrstages; i++)
+  {
+    m_stages[i].fft.Allocate(fftsize, Max(hop >> i, 1u), window);
+    m_stages[i].magnitudes.resize(m_stages[i].fft.m_nrbins, 0.0f);
+    m_stages[i].hasframes = false;
+
+    //the deepest stage went through all decimators, every stage above it through one less,
+    //in samples of this stage that's the delay of the decimators below it
+    m_stages[i].delay.assign(CDecimator::Delay() * ((1 << (m_nrstages - i)) - 1), 0.0f);
+  }
+
+  LogDebug("Multiresolution stages are delayed to line up, the spectrum lags the input by %i samples", Delay());
+
+  //force a rebuild of the column table
+  m_samplerate = 0;
+}
+
+void CMultiResFft::Free()
+{
+  delete[] m_stages;
+  m_stages = NULL;
+  m_nrstages = 0;
+  m_fftsize = 0;
+}
+
+void CMultiResFft::Build(int samplerate, int reffftsize, int nrcolumns, FrequencyScale scale)
+{
+  if (samplerate == m_samplerate && reffftsize == m_reffftsize && nrcolumns == m_nrcolumns && scale == m_scale)
+    return;
+
+  m_samplerate = samplerate;
+  m_reffftsize = reffftsize;
+  m_nrcolumns = nrcolumns;
+  m_scale = scale;
+
+  std::vector<float> lower;
+  std::vector<float> upper;
+  CBinMap::ColumnRanges(samplerate, reffftsize, nrcolumns, scale, lower, upper);
+
+  m_columnstart.clear();
+  m_columnstage.clear();
+  m_bins.clear();
+  m_weights.clear();
+  m_columns.resize(m_nrcolumns);
+
+  std::vector<int> stagecolumns(m_nrstages + 1, 0);
+
+  for (int i = 0; i < m_nrcolumns; i++)
+  {
+    m_columnstart.push_back(m_bins.size());
+
+    //go down a stage while the bins are wider than the column,
+    //and the lower samplerate still passes the top of the column
+    int   stagenr = 0;
+    float binsize = (float)samplerate / m_fftsize;
+    while (stagenr < m_nrstages && binsize > upper[i] - lower[i] &&
+           upper[i] <= (float)(samplerate >> (stagenr + 1)) * DECIMATORPASSBAND)
+    {
+      stagenr++;
+      binsize *= 0.5f;
+    }
+
+    m_columnstage.push_back(stagenr);
+    stagecolumns[stagenr]++;
+
+    //same weights as CBinMap::BuildScale(), in bins of this stage
+    float lowerbin = lower[i] / binsize;
+    float upperbin = upper[i] / binsize;
+    if (upperbin - lowerbin < 1.0f)
+    {
+      float center = (lowerbin + upperbin) * 0.5f;
+      int   bin    = (int)center;
+      float frac   = center - bin;
+
+      AddWeight(bin, 1.0f - frac);
+      AddWeight(bin + 1, frac);
+    }
+    else
+    {
+      for (int bin = (int)(lowerbin + 0.5f); bin <= (int)(upperbin + 0.5f); bin++)
+      {
+        float overlap = Min(upperbin, bin + 0.5f) - Max(lowerbin, bin - 0.5f);
+        if (overlap > 0.0f)
+          AddWeight(bin, overlap);
+      }
+    }
+  }
+
+  m_columnstart.push_back(m_bins.size());
+
+  for (int i = 0; i <= m_nrstages; i++)
+    LogDebug("Multiresolution stage %i: samplerate %i, bin size %.2f Hz, %i columns",
+             i, samplerate >> i, (float)(samplerate >> i) / m_fftsize, stagecolumns[i]);
+}
+
+void CMultiResFft::AddWeight(int bin, float weight)
+{
+  //skip the dc bin, and everything past the last bin
+  if (bin < 1 || bin >= (int)m_fftsize / 2 || weight <= 0.0f)
+    return;
+
+  m_bins.push_back(bin);
+  m_weights.push_back(weight);
+}
+
+void CMultiResFft::AddSamples(const float* samples, unsigned int nrsamples)
+{
+  m_stages[0].fft.AddSamples(DelayInput(m_stages[0], samples, nrsamples), nrsamples);
+
+  //every stage decimates the input of the previous one
+  const float* input = samples;
+  int          nrinput = nrsamples;
+  for (int i = 1; i <= m_nrstages && nrinput > 0; i++)
+  {
+    float* decimated;
+    nrinput = m_stages[i].decimator.Process(input, nrinput, decimated);
+    if (nrinput > 0)
+      m_stages[i].fft.AddSamples(DelayInput(m_stages[i], decimated, nrinput), nrinput);
+
+    input = decimated;
+  }
+}
+
+//returns the input delayed by the size of the stage's delay line,
+//the next decimator still gets the undelayed input
+const float* CMultiResFft::DelayInput(stage& st, const float* samples, unsigned int nrsamples)
+{
+  if (st.delay.empty())
+    return samples;
+
+  const unsigned int delaysize = st.delay.size();
+  if (st.delayed.size() < delaysize + nrsamples)
+    st.delayed.resize(delaysize + nrsamples);
+
+  memcpy(&st.delayed[0], &st.delay[0], delaysize * sizeof(float));
+  memcpy(&st.delayed[delaysize], samples, nrsamples * sizeof(float));
+  memcpy(&st.delay[0], &st.delayed[nrsamples], delaysize * sizeof(float));
+
+  return &st.delayed[0];
+}
+
+const float* CMultiResFft::Apply()
+{
+  bool complete = true;
+  for (int i = 0; i <= m_nrstages; i++)
+  {
+    stage& st = m_stages[i];
+    if (st.fft.m_nrframes > 0)
+    {
+      float mul = 1.0f / st.fft.m_nrframes;
+      for (unsigned int j = 0; j < st.fft.m_nrbins; j++)
+        st.magnitudes[j] = st.fft.m_magnitudes[j] * mul;
+
+      st.fft.ResetMagnitudes();
+      st.hasframes = true;
+    }
+
+    complete = complete && st.hasframes;
+  }
+
+  if (!complete)
+    return NULL;
+
+  for (int i = 0; i < m_nrcolumns; i++)
+  {
+    const float* magnitudes = &m_stages[m_columnstage[i]].magnitudes[0];
+
+    float value = 0.0f;
+    for (int j = m_columnstart[i]; j < m_columnstart[i + 1]; j++)
+      value += magnitudes[m_bins[j]] * m_weights[j];
+
+    m_columns[i] = value;
+  }
+
+  return &m_columns[0];
+}
+
+void CMultiResFft::WaitForPlans()
+{
+  for (int i = 0; i <= m_nrstages; i++)
+    m_stages[i].fft.WaitForPlan();
+}
+
+//compares the cost of one large fft with the stages that give the same resolution at the lowest octave,
+//over 10 seconds of noise, fed in blocks like the audio sources do
+void CMultiResFft::Benchmark()
+{
+  const int          samplerate = 44100;
+  const unsigned int blocksize  = 1024;
+  const unsigned int fftsize    = 2048;
+  const unsigned int hop        = fftsize / 4;
+
+  std::vector<float> samples(samplerate * 10);
+  for (size_t i = 0; i < samples.size(); i++)
+    samples[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+
+  Cfft fft;
+  fft.Allocate(fftsize, hop, WindowHamming);
+  fft.WaitForPlan();
+
+  int64_t start = GetThreadCpuTimeUs();
+  for (size_t i = 0; i + blocksize <= samples.size(); i += blocksize)
+  {
+    fft.AddSamples(&samples[i], blocksize);
+    fft.ResetMagnitudes();
+  }
+  int64_t ffttime = GetThreadCpuTimeUs() - start;
+
+  Log("Benchmark: single fft size %u hop %u: %.2f ms per second of audio, bin size %.2f Hz",
+      fftsize, hop, (double)ffttime / 10000.0, (float)samplerate / fftsize);
+
+  for (int nrstages = 2; nrstages <= 6; nrstages += 2)
+  {
+    CMultiResFft multires;
+    multires.Allocate(nrstages, fftsize / 4, fftsize / 4 / 4, WindowHamming);
+    multires.Build(samplerate, fftsize, 120, ScaleLog);
+    multires.WaitForPlans();
+
+    start = GetThreadCpuTimeUs();
+    for (size_t i = 0; i + blocksize <= samples.size(); i += blocksize)
+    {
+      multires.AddSamples(&samples[i], blocksize);
+      multires.Apply();
+    }
+    int64_t multirestime = GetThreadCpuTimeUs() - start;
+
+    Log("Benchmark: multiresolution fft size %u, %i stages: %.2f ms per second of audio, "
+        "bin size %.2f Hz at the full samplerate, %.2f Hz at the lowest stage",
+        fftsize / 4, nrstages, (double)multirestime / 10000.0,
+        (float)samplerate / (fftsize / 4), (float)(samplerate >> nrstages) / (fftsize / 4));
+  }
+}
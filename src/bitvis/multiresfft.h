@@ -0,0 +1,92 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MULTIRESFFT_H
+#define MULTIRESFFT_H
+
+#include <vector>
+
+#include "fft.h"
+#include "binmap.h"
+#include "decimator.h"
+
+//constant-Q style spectrum from several small ffts instead of one large one,
+//every stage runs the same fft size on a copy of the signal decimated by another factor of 2,
+//so every octave down has twice the frequency resolution and half the time resolution,
+//each display column takes its bins from the stage with the shortest window that still resolves it
+class CMultiResFft
+{
+  public:
+    CMultiResFft();
+    ~CMultiResFft();
+
+    //nrstages is the number of decimated stages below the one at the full samplerate,
+    //hop is for the first stage at the full samplerate, it is halved for every decimated stage
+    //so all stages advance by the same time,
+    //every decimator delays its stage by CDecimator::Delay() of its input samples, so the stages above the
+    //deepest one are delayed to line up with it, the whole spectrum then lags the input by Delay() samples
+    void         Allocate(int nrstages, unsigned int fftsize, unsigned int hop, WindowType window);
+    void         Free();
+
+    //reffftsize is the fft size the column layout is based on, so the layout matches a single fft of that size,
+    //only rebuilds the table when one of the parameters changes
+    void         Build(int samplerate, int reffftsize, int nrcolumns, FrequencyScale scale);
+
+    void         AddSamples(const float* samples, unsigned int nrsamples);
+
+    //maps the averaged magnitudes since the last call to the columns,
+    //stages without a new fft keep their previous magnitudes, returns NULL until every stage did an fft
+    const float* Apply();
+
+    void         WaitForPlans();
+    int          Stages() { return m_nrstages; }
+    int          Delay()  { return CDecimator::Delay() * ((1 << m_nrstages) - 1); } //in samples at the full samplerate
+
+    static void  Benchmark();
+
+  private:
+    struct stage
+    {
+      Cfft               fft;
+      CDecimator         decimator;  //makes the input of this stage from the input of the previous one
+      std::vector<float> magnitudes; //averaged magnitudes of the last ffts
+      bool               hasframes;
+      std::vector<float> delay;      //the last input samples, to line this stage up with the deepest one
+      std::vector<float> delayed;
+    };
+
+    void         AddWeight(int bin, float weight);
+    const float* DelayInput(stage& st, const float* samples, unsigned int nrsamples);
+
+    int            m_nrstages;
+    stage*         m_stages; //m_nrstages + 1, the first one runs at the full samplerate
+    unsigned int   m_fftsize;
+
+    int            m_samplerate;
+    int            m_reffftsize;
+    int            m_nrcolumns;
+    FrequencyScale m_scale;
+
+    std::vector<int>   m_columnstart; //index of the first weight of every column, with one extra at the end
+    std::vector<int>   m_columnstage; //the stage every column takes its bins from
+    std::vector<int>   m_bins;
+    std::vector<float> m_weights;
+    std::vector<float> m_columns;
+};
+
+#endif //MULTIRESFFT_H
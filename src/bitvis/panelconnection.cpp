@@ -0,0 +1,257 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "panelconnection.h"
+#include "util/log.h"
+#include "util/timeutils.h"
+#include "util/misc.h"
+
+//time between connection attempts, doubles after every failed attempt
+#define MINRECONNECTINTERVAL 500000
+#define MAXRECONNECTINTERVAL 30000000
+
+//an unreachable host can take minutes to fail the connect
+#define CONNECTTIMEOUT 5000000
+
+CPanelConnection::CPanelConnection()
+{
+  m_eventloop = NULL;
+  m_port = 0;
+  m_state = StateStopped;
+  m_statetime = GetTimeUs();
+  m_failures = 0;
+}
+
+CPanelConnection::~CPanelConnection()
+{
+  Stop();
+}
+
+void CPanelConnection::Setup(CEventLoop* eventloop, const std::string& address, int port, int columns, int lines)
+{
+  m_eventloop = eventloop;
+  m_address = address;
+  m_port = port;
+  m_encoder.SetSize(columns, lines);
+
+  //the host is only looked up here, a slow lookup in the event loop would stall the other panels
+  if (m_socket.Resolve(address, port) != SUCCESS)
+    LogError("%s", m_socket.GetError().c_str());
+}
+
+void CPanelConnection::Start()
+{
+  if (m_state == StateStopped)
+    Connect();
+}
+
+void CPanelConnection::Stop()
+{
+  if (m_state != StateStopped)
+    Disconnect(false);
+}
+
+void CPanelConnection::Send(struct iovec* iov, int iovcnt)
+{
+  int byteswritten;
+  if (m_socket.TryWrite(iov, iovcnt, byteswritten) != SUCCESS)
+  {
+    LogError("%s", m_socket.GetError().c_str());
+    Disconnect(true);
+    return;
+  }
+
+  //keep what didn't fit in the socket buffer
+  for (int i = 0; i < iovcnt; i++)
+  {
+    if (byteswritten >= (int)iov[i].iov_len)
+    {
+      byteswritten -= iov[i].iov_len;
+    }
+    else
+    {
+      m_pending.insert(m_pending.end(), (uint8_t*)iov[i].iov_base + byteswritten,
+                       (uint8_t*)iov[i].iov_base + iov[i].iov_len);
+      byteswritten = 0;
+    }
+  }
+
+  if (!m_pending.empty())
+    m_eventloop->Modify(m_socket.GetSock(), EPOLLOUT, this);
+}
+
+void CPanelConnection::Send(CTcpData& data)
+{
+  struct iovec iov;
+  iov.iov_base = data.GetData();
+  iov.iov_len = data.GetSize();
+  Send(&iov, 1);
+}
+
+void CPanelConnection::OnEvent(uint32_t events)
+{
+  if (m_state == StateConnecting)
+  {
+    if (m_socket.FinishConnect() != SUCCESS)
+    {
+      LogError("Failed to connect: %s", m_socket.GetError().c_str());
+      ConnectFailed();
+      return;
+    }
+
+    Log("Connected to %s:%i", m_address.c_str(), m_port);
+    SetState(StateConnected);
+    m_eventloop->ClearTimer(this);
+    m_failures = 0;
+    m_encoder.Reset();
+
+    //only wait for errors until there's something to write
+    m_eventloop->Modify(m_socket.GetSock(), 0, this);
+  }
+  else if (m_state == StateConnected)
+  {
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+      LogError("Connection to %s:%i closed", m_address.c_str(), m_port);
+      Disconnect(true);
+    }
+    else if (events & EPOLLOUT)
+    {
+      WritePending();
+    }
+  }
+}
+
+void CPanelConnection::OnTimer()
+{
+  if (m_state == StateWaiting)
+  {
+    Connect();
+  }
+  else if (m_state == StateConnecting)
+  {
+    LogError("Timed out connecting to %s:%i", m_address.c_str(), m_port);
+    ConnectFailed();
+  }
+}
+
+const char* CPanelConnection::StateToString()
+{
+  if (m_state == StateWaiting)
+    return "waiting to reconnect";
+  else if (m_state == StateConnecting)
+    return "connecting";
+  else if (m_state == StateConnected)
+    return "connected";
+  else
+    return "stopped";
+}
+
+void CPanelConnection::SetState(State state)
+{
+  if (state != m_state)
+  {
+    m_state = state;
+    m_statetime = GetTimeUs();
+  }
+}
+
+void CPanelConnection::Connect()
+{
+  if (m_socket.OpenNonBlock() != SUCCESS)
+  {
+    LogError("Failed to connect: %s", m_socket.GetError().c_str());
+    Disconnect(true);
+    return;
+  }
+
+  //the socket becomes writeable when the connect finished, or failed
+  SetState(StateConnecting);
+  m_eventloop->Add(m_socket.GetSock(), EPOLLOUT, this);
+  m_eventloop->SetTimer(this, GetTimeUs() + CONNECTTIMEOUT);
+}
+
+//tries the next address of the host right away, when all of them failed it backs off
+void CPanelConnection::ConnectFailed()
+{
+  if (m_socket.NextAddress())
+  {
+    m_eventloop->Remove(m_socket.GetSock());
+    m_eventloop->ClearTimer(this);
+    Connect();
+  }
+  else
+  {
+    Disconnect(true);
+  }
+}
+
+void CPanelConnection::Disconnect(bool reconnect)
+{
+  if (m_socket.IsOpen())
+  {
+    m_eventloop->Remove(m_socket.GetSock());
+    m_socket.Close();
+  }
+
+  m_pending.clear();
+  m_eventloop->ClearTimer(this);
+
+  if (!reconnect)
+  {
+    SetState(StateStopped);
+    return;
+  }
+
+  //a connection that was up reconnects quickly, failed attempts back off
+  int64_t interval = MINRECONNECTINTERVAL;
+  if (m_state != StateConnected)
+  {
+    if (m_failures < 16)
+      interval = Min((int64_t)MINRECONNECTINTERVAL << m_failures, (int64_t)MAXRECONNECTINTERVAL);
+    else
+      interval = MAXRECONNECTINTERVAL;
+
+    m_failures++;
+  }
+
+  LogDebug("Reconnecting to %s:%i in %.1f seconds", m_address.c_str(), m_port, interval / 1000000.0);
+
+  SetState(StateWaiting);
+  m_eventloop->SetTimer(this, GetTimeUs() + interval);
+}
+
+void CPanelConnection::WritePending()
+{
+  struct iovec iov;
+  iov.iov_base = &m_pending[0];
+  iov.iov_len = m_pending.size();
+
+  int byteswritten;
+  if (m_socket.TryWrite(&iov, 1, byteswritten) != SUCCESS)
+  {
+    LogError("%s", m_socket.GetError().c_str());
+    Disconnect(true);
+    return;
+  }
+
+  m_pending.erase(m_pending.begin(), m_pending.begin() + byteswritten);
+
+  if (m_pending.empty())
+    m_eventloop->Modify(m_socket.GetSock(), 0, this);
+}
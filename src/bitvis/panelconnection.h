@@ -0,0 +1,93 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PANELCONNECTION_H
+#define PANELCONNECTION_H
+
+#include <string>
+#include <vector>
+
+#include "util/inclstdint.h"
+#include "util/tcpsocket.h"
+#include "util/eventloop.h"
+#include "util/frameencoder.h"
+
+//connection to one panel, driven by a CEventLoop
+//connecting and writing never block, when the previous frame is still
+//being written the next one is skipped
+//failed connection attempts are retried with exponential backoff
+class CPanelConnection : public CEventHandler
+{
+  public:
+    CPanelConnection();
+    ~CPanelConnection();
+
+    void Setup(CEventLoop* eventloop, const std::string& address, int port, int columns, int lines);
+
+    //starts connecting, and reconnects after every error
+    void Start();
+    void Stop();
+
+    //true when a frame can be sent now
+    bool CanSend() { return m_state == StateConnected && m_pending.empty(); }
+
+    //writes what fits in the socket buffer, the rest is written when the socket becomes writeable
+    void Send(struct iovec* iov, int iovcnt);
+    void Send(CTcpData& data);
+
+    CFrameEncoder&     Encoder() { return m_encoder; }
+    CTcpClientSocket&  Socket()  { return m_socket;  }
+    const std::string& Address() { return m_address; }
+    int                Port()    { return m_port;    }
+
+    //health of the connection
+    bool               IsConnected() { return m_state == StateConnected; }
+    const char*        StateToString();
+    int64_t            StateTime()   { return m_statetime; } //when the current state was entered
+    int                Failures()    { return m_failures;  } //connection attempts that failed in a row
+
+    virtual void OnEvent(uint32_t events);
+    virtual void OnTimer();
+
+  private:
+    enum State
+    {
+      StateStopped,
+      StateWaiting,    //waiting for the reconnect timer
+      StateConnecting,
+      StateConnected,
+    };
+
+    void SetState(State state);
+    void Connect();
+    void ConnectFailed();
+    void Disconnect(bool reconnect);
+    void WritePending();
+
+    CEventLoop*          m_eventloop;
+    CTcpClientSocket     m_socket;
+    std::string          m_address;
+    int                  m_port;
+    State                m_state;
+    int64_t              m_statetime;
+    int                  m_failures;
+    std::vector<uint8_t> m_pending;
+    CFrameEncoder        m_encoder;
+};
+
+#endif //PANELCONNECTION_H
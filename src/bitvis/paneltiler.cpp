@@ -0,0 +1,87 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "paneltiler.h"
+
+static const uint8_t g_header[3] = {':', '0', '0'};
+static const uint8_t g_trailer[10] = {};
+
+CPanelTiler::CPanelTiler()
+{
+  m_panelcolumns = 120;
+  m_panellines = 48;
+  m_tilesx = 1;
+  m_tilesy = 1;
+}
+
+//panels need a multiple of 4 columns, since a byte holds 4 pixels
+bool CPanelTiler::SetLayout(int panelcolumns, int panellines, int tilesx, int tilesy)
+{
+  if (panelcolumns <= 0 || panelcolumns % 4 != 0 || panellines <= 0 || tilesx <= 0 || tilesy <= 0)
+    return false;
+
+  m_panelcolumns = panelcolumns;
+  m_panellines = panellines;
+  m_tilesx = tilesx;
+  m_tilesy = tilesy;
+
+  return true;
+}
+
+const uint8_t* CPanelTiler::PanelRows(const uint8_t* framebuffer, int panel)
+{
+  return framebuffer + (panel / m_tilesx) * m_panellines * RowBytes() + (panel % m_tilesx) * m_panelcolumns / 4;
+}
+
+int CPanelTiler::MakePanelIovecs(const uint8_t* framebuffer, int panel, struct iovec* iov)
+{
+  const uint8_t* row = PanelRows(framebuffer, panel);
+
+  int iovcnt = 0;
+  iov[iovcnt].iov_base = (void*)g_header;
+  iov[iovcnt++].iov_len = sizeof(g_header);
+
+  //with one panel horizontally, the rows are contiguous
+  if (m_tilesx == 1)
+  {
+    iov[iovcnt].iov_base = (void*)row;
+    iov[iovcnt++].iov_len = m_panellines * RowBytes();
+  }
+  else
+  {
+    for (int i = 0; i < m_panellines; i++)
+    {
+      iov[iovcnt].iov_base = (void*)row;
+      iov[iovcnt++].iov_len = m_panelcolumns / 4;
+      row += RowBytes();
+    }
+  }
+
+  iov[iovcnt].iov_base = (void*)g_trailer;
+  iov[iovcnt++].iov_len = sizeof(g_trailer);
+
+  return iovcnt;
+}
+
+//a frame is ":00", the rows of pixels, then 10 zero bytes
+void CPanelTiler::MakeFrame(const uint8_t* framebuffer, CTcpData& data)
+{
+  data.SetData((uint8_t*)g_header, sizeof(g_header));
+  data.SetData(const_cast<uint8_t*>(framebuffer), Lines() * RowBytes(), true);
+  data.SetData((uint8_t*)g_trailer, sizeof(g_trailer), true);
+}
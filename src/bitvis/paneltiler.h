@@ -0,0 +1,62 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PANELTILER_H
+#define PANELTILER_H
+
+#include <sys/uio.h>
+
+#include "util/inclstdint.h"
+#include "util/tcpsocket.h"
+
+//splits one large virtual display into a grid of panels,
+//the framebuffer has 2 bits per pixel, 4 pixels per byte, rows from top to bottom
+class CPanelTiler
+{
+  public:
+    CPanelTiler();
+
+    bool SetLayout(int panelcolumns, int panellines, int tilesx, int tilesy);
+
+    int  PanelColumns() { return m_panelcolumns;            }
+    int  PanelLines()   { return m_panellines;              }
+    int  Columns()      { return m_panelcolumns * m_tilesx; }
+    int  Lines()        { return m_panellines * m_tilesy;   }
+    int  RowBytes()     { return Columns() / 4;             }
+    int  NrPanels()     { return m_tilesx * m_tilesy;       }
+
+    //fills iov with the frame of one panel, pointing into the framebuffer,
+    //panels are numbered left to right, top to bottom
+    //iov needs room for PanelIovecs() buffers, returns the number of buffers used
+    int  PanelIovecs()  { return m_panellines + 2;          }
+    int  MakePanelIovecs(const uint8_t* framebuffer, int panel, struct iovec* iov);
+
+    //returns the first row of a panel, rows are RowBytes() apart
+    const uint8_t* PanelRows(const uint8_t* framebuffer, int panel);
+
+    //makes one frame of the whole virtual display
+    void MakeFrame(const uint8_t* framebuffer, CTcpData& data);
+
+  private:
+    int m_panelcolumns;
+    int m_panellines;
+    int m_tilesx;
+    int m_tilesy;
+};
+
+#endif //PANELTILER_H
@@ -0,0 +1,172 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "scopecorrelator.h"
+#include "fft.h"
+#include "util/log.h"
+#include "util/lock.h"
+
+//above this many multiply-adds per search, the fft correlation is cheaper than the direct one
+#define FFTTHRESHOLD 32768
+
+CScopeCorrelator::CScopeCorrelator()
+{
+  m_templatesize = 0;
+  m_searchsize = 0;
+  m_usefft = false;
+  m_fftsize = 0;
+  m_fftin = NULL;
+  m_fftout = NULL;
+  m_bufspectrum = NULL;
+  m_templspectrum = NULL;
+  m_forwardplan = NULL;
+  m_inverseplan = NULL;
+}
+
+CScopeCorrelator::~CScopeCorrelator()
+{
+  Free();
+}
+
+void CScopeCorrelator::Allocate(int templatesize, int searchsize)
+{
+  Free();
+
+  m_templatesize = templatesize;
+  m_searchsize = searchsize;
+  m_usefft = templatesize * searchsize > FFTTHRESHOLD;
+
+  if (!m_usefft)
+    return;
+
+  //a circular correlation of at least the buffer size doesn't wrap around for the offsets we search
+  m_fftsize = 1;
+  while (m_fftsize < templatesize + searchsize)
+    m_fftsize <<= 1;
+
+  m_fftin = (float*)fftwf_malloc(m_fftsize * sizeof(float));
+  m_fftout = (float*)fftwf_malloc(m_fftsize * sizeof(float));
+  m_bufspectrum = (fftwf_complex*)fftwf_malloc((m_fftsize / 2 + 1) * sizeof(fftwf_complex));
+  m_templspectrum = (fftwf_complex*)fftwf_malloc((m_fftsize / 2 + 1) * sizeof(fftwf_complex));
+
+  //these are small, so estimating is good enough
+  CLock lock(Cfft::PlannerLock());
+  m_forwardplan = fftwf_plan_dft_r2c_1d(m_fftsize, m_fftin, m_bufspectrum, FFTW_ESTIMATE);
+  m_inverseplan = fftwf_plan_dft_c2r_1d(m_fftsize, m_bufspectrum, m_fftout, FFTW_ESTIMATE);
+
+  LogDebug("Using fft size %i for scope correlation of %i samples over %i offsets",
+           m_fftsize, templatesize, searchsize);
+}
+
+void CScopeCorrelator::Free()
+{
+  //without plans there's no need to wait for the planner lock
+  if (m_forwardplan || m_inverseplan)
+  {
+    CLock lock(Cfft::PlannerLock());
+    if (m_forwardplan)
+    {
+      fftwf_destroy_plan(m_forwardplan);
+      m_forwardplan = NULL;
+    }
+
+    if (m_inverseplan)
+    {
+      fftwf_destroy_plan(m_inverseplan);
+      m_inverseplan = NULL;
+    }
+  }
+
+  fftwf_free(m_fftin);
+  fftwf_free(m_fftout);
+  fftwf_free(m_bufspectrum);
+  fftwf_free(m_templspectrum);
+  m_fftin = NULL;
+  m_fftout = NULL;
+  m_bufspectrum = NULL;
+  m_templspectrum = NULL;
+  m_fftsize = 0;
+  m_usefft = false;
+}
+
+int CScopeCorrelator::FindOffset(const float* templ, const float* buf)
+{
+  if (m_usefft)
+    return FindOffsetFFT(templ, buf);
+  else
+    return FindOffsetDirect(templ, buf);
+}
+
+//buf is linear, so the inner loop has no wraparound and can be vectorized
+int CScopeCorrelator::FindOffsetDirect(const float* templ, const float* buf)
+{
+  int   offset = 0;
+  float maxweight = 0.0f;
+  for (int i = 0; i < m_searchsize; i++)
+  {
+    const float* bufptr = buf + i;
+    float weight = 0.0f;
+    for (int j = 0; j < m_templatesize; j++)
+      weight += templ[j] * bufptr[j];
+
+    if (weight > maxweight)
+    {
+      maxweight = weight;
+      offset = i;
+    }
+  }
+
+  return offset;
+}
+
+//the correlation is the inverse fft of the buffer spectrum times the conjugate of the template spectrum
+int CScopeCorrelator::FindOffsetFFT(const float* templ, const float* buf)
+{
+  memset(m_fftin, 0, m_fftsize * sizeof(float));
+  memcpy(m_fftin, templ, m_templatesize * sizeof(float));
+  fftwf_execute_dft_r2c(m_forwardplan, m_fftin, m_templspectrum);
+
+  memcpy(m_fftin, buf, (m_templatesize + m_searchsize) * sizeof(float));
+  fftwf_execute_dft_r2c(m_forwardplan, m_fftin, m_bufspectrum);
+
+  for (int i = 0; i < m_fftsize / 2 + 1; i++)
+  {
+    float real = m_bufspectrum[i][0] * m_templspectrum[i][0] + m_bufspectrum[i][1] * m_templspectrum[i][1];
+    float imag = m_bufspectrum[i][1] * m_templspectrum[i][0] - m_bufspectrum[i][0] * m_templspectrum[i][1];
+    m_bufspectrum[i][0] = real;
+    m_bufspectrum[i][1] = imag;
+  }
+
+  fftwf_execute(m_inverseplan);
+
+  //the output is scaled by the fft size, which doesn't matter for finding the maximum
+  int   offset = 0;
+  float maxweight = 0.0f;
+  for (int i = 0; i < m_searchsize; i++)
+  {
+    if (m_fftout[i] > maxweight)
+    {
+      maxweight = m_fftout[i];
+      offset = i;
+    }
+  }
+
+  return offset;
+}
@@ -0,0 +1,55 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCOPECORRELATOR_H
+#define SCOPECORRELATOR_H
+
+#include <complex.h>
+#include <fftw3.h>
+
+//finds the offset in a buffer where a template matches best, by cross correlation
+//small sizes use a direct sliding dot product, large sizes correlate through an fft
+class CScopeCorrelator
+{
+  public:
+    CScopeCorrelator();
+    ~CScopeCorrelator();
+
+    void Allocate(int templatesize, int searchsize);
+    void Free();
+
+    //buf has templatesize + searchsize samples, returns the offset with the highest positive correlation
+    int  FindOffset(const float* templ, const float* buf);
+
+  private:
+    int  FindOffsetDirect(const float* templ, const float* buf);
+    int  FindOffsetFFT(const float* templ, const float* buf);
+
+    int            m_templatesize;
+    int            m_searchsize;
+    bool           m_usefft;
+    int            m_fftsize;
+    float*         m_fftin;
+    float*         m_fftout;
+    fftwf_complex* m_bufspectrum;
+    fftwf_complex* m_templspectrum;
+    fftwf_plan     m_forwardplan;
+    fftwf_plan     m_inverseplan;
+};
+
+#endif //SCOPECORRELATOR_H
@@ -37,8 +37,9 @@ CBitX11::CBitX11(int argc, char *argv[])
   m_destheight = 48;
   m_debug = false;
   m_debugscale = 2;
+  m_delta = false;
 
-  const char* flags = "p:a:f:d:s";
+  const char* flags = "p:a:f:d:se";
   int c;
   while ((c = getopt(argc, argv, flags)) != -1)
   {
@@ -85,6 +86,10 @@ CBitX11::CBitX11(int argc, char *argv[])
     {
       m_dither = true;
     }
+    else if (c == 'e') //only send the rows that changed
+    {
+      m_delta = true;
+    }
   }
 
   //if no address is specified, turn on the debug window instead
@@ -136,6 +141,9 @@ void CBitX11::Setup()
   m_shmseginfo.readOnly = False;
   XShmAttach(m_dpy, &m_shmseginfo);
 
+  m_encoder.SetSize(m_destwidth, m_destheight);
+  m_debugencoder.SetSize(m_destwidth, m_destheight);
+
   if (m_debug)
     m_debugwindow.Enable(m_destwidth, m_destheight, m_debugscale);
 }
@@ -155,6 +163,7 @@ void CBitX11::Process()
       else
       {
         Log("Connected");
+        m_encoder.Reset();
       }
     }
 
@@ -263,14 +272,15 @@ void CBitX11::Process()
 
     if (m_socket.IsOpen())
     {
-      if (m_socket.Write(data) != SUCCESS)
+      if (m_socket.Write(m_delta ? m_encoder.Encode(data) : data) != SUCCESS)
       {
         LogError("%s", m_socket.GetError().c_str());
         m_socket.Close();
       }
     }
 
-    m_debugwindow.DisplayFrame(data);
+    if (m_debug)
+      m_debugwindow.DisplayFrame(m_delta ? m_debugencoder.Encode(data) : data);
 
     looptime += Round64(1000000.0f / m_fps);
     USleep(looptime - GetTimeUs());
@@ -21,6 +21,7 @@
 
 #include "util/tcpsocket.h"
 #include "util/debugwindow.h"
+#include "util/frameencoder.h"
 
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
@@ -50,6 +51,9 @@ class CBitX11
     CDebugWindow       m_debugwindow;
 
     CTcpClientSocket   m_socket;
+    bool               m_delta;
+    CFrameEncoder      m_encoder;
+    CFrameEncoder      m_debugencoder;
 
     Display*           m_dpy;
     Window             m_rootwin;
@@ -21,6 +21,7 @@
 #include "log.h"
 #include "timeutils.h"
 #include "inclstdint.h"
+#include "frameencoder.h"
 
 #include <cstring>
 #include <cstdlib>
@@ -58,6 +59,9 @@ void CDebugWindow::Enable(int width, int height, int scale)
   m_height = height;
   m_scale = scale;
 
+  //the ":00" header, every row, and 10 zero bytes
+  m_pool.SetFrameSize(3 + width * height / 4 + 10);
+
   StartThread();
 }
 
@@ -69,14 +73,34 @@ void CDebugWindow::Disable()
   m_condition.Signal();
   lock.Leave();
   StopThread();
+
+  while (!m_data.empty())
+  {
+    m_data.front()->Release();
+    m_data.pop_front();
+  }
 }
 
+//copies the data into a frame from the pool
 void CDebugWindow::DisplayFrame(CTcpData& data)
 {
-  if (m_running)
+  if (IsRunning())
   {
+    CFrame* frame = m_pool.GetFrame();
+    frame->Data().SetData((uint8_t*)data.GetData(), data.GetSize());
+    DisplayFrame(frame);
+    frame->Release();
+  }
+}
+
+//keeps a reference to the frame until it's displayed
+void CDebugWindow::DisplayFrame(CFrame* frame)
+{
+  if (IsRunning())
+  {
+    frame->AddRef();
     CLock lock(m_condition);
-    m_data.push_back(data);
+    m_data.push_back(frame);
     m_process = true;
     m_condition.Signal();
   }
@@ -176,7 +200,6 @@ void CDebugWindow::Cleanup()
   }
 }
 
-#define BYTESPERFRAME  (120 * 48 / 4 + 3)
 #define BAUDRATE       (500000)
 
 void CDebugWindow::ProcessInternal()
@@ -185,6 +208,9 @@ void CDebugWindow::ProcessInternal()
   int     count  = -3;
   int     xcount = 0;
   int     ycount = 0;
+  bool    delta  = false;
+  bool    inrow  = false;
+  int     bytes  = 0;
   int64_t lastrender = GetTimeUs();
 
   while (!m_stop)
@@ -198,10 +224,11 @@ void CDebugWindow::ProcessInternal()
                        0, 0, 0, 0, 0, 0, m_width * m_scale, m_height * m_scale);
 
       //add a delay, to simulate the bytes being transferred over rs232 to the bitpanel
-      int64_t frametime = 1000000LL * 10 * BYTESPERFRAME / BAUDRATE;
+      int64_t frametime = 1000000LL * 10 * bytes / BAUDRATE;
       int64_t now = GetTimeUs();
       USleep(lastrender + frametime - now);
       lastrender = GetTimeUs();
+      bytes = 0;
 
       XFlush(m_dpy);
       render = false;
@@ -218,12 +245,13 @@ void CDebugWindow::ProcessInternal()
     if (m_data.empty())
       continue;
 
-    CTcpData data = m_data.front();
+    CFrame* frame = m_data.front();
     m_data.pop_front();
     lock.Leave();
 
-    int size = data.GetSize();
-    uint8_t* dataptr = (uint8_t*)data.GetData();
+    int size = frame->Data().GetSize();
+    uint8_t* dataptr = (uint8_t*)frame->Data().GetData();
+    bytes += size;
     for (int i = 0; i < size; i++)
     {
       if (count == -3)
@@ -231,13 +259,48 @@ void CDebugWindow::ProcessInternal()
         if (dataptr[i] == ':')
           count++;
       }
-      else if (count == -2 || count == -1)
+      else if (count == -2)
       {
         if (dataptr[i] == '0')
           count++;
         else
           count = -3;
       }
+      else if (count == -1)
+      {
+        //":00" starts a full frame, ":01" a delta frame
+        if (dataptr[i] == '0' || dataptr[i] == '1')
+        {
+          count++;
+          delta = dataptr[i] == '1';
+          inrow = false;
+          xcount = 0;
+          ycount = 0;
+        }
+        else
+        {
+          count = -3;
+        }
+      }
+      else if (delta && !inrow)
+      {
+        //every changed row starts with its index, the end of the frame is marked with DELTAEND
+        if (dataptr[i] == DELTAEND)
+        {
+          render = true;
+          count = -3;
+        }
+        else if (dataptr[i] < m_height)
+        {
+          inrow = true;
+          ycount = dataptr[i];
+          xcount = 0;
+        }
+        else
+        {
+          count = -3;
+        }
+      }
       else
       {
         uint8_t* pixelptr = (uint8_t*)m_xim->data + ycount * m_xim->bytes_per_line + xcount * 4;
@@ -248,7 +311,12 @@ void CDebugWindow::ProcessInternal()
           *(pixelptr++) = ((dataptr[i] << (j * 2)) & 128) ? 0xFF : 0;
           pixelptr++;
           xcount++;
-          if (xcount == m_width)
+          if (xcount == m_width && delta)
+          {
+            xcount = 0;
+            inrow = false;
+          }
+          else if (xcount == m_width)
           {
             xcount = 0;
             ycount++;
@@ -262,5 +330,7 @@ void CDebugWindow::ProcessInternal()
         }
       }
     }
+
+    frame->Release();
   }
 }
@@ -22,6 +22,7 @@
 #include "thread.h"
 #include "condition.h"
 #include "tcpsocket.h"
+#include "framepool.h"
 
 #include <deque>
 
@@ -37,6 +38,7 @@ class CDebugWindow : public CThread
     void Enable(int width, int height, int scale);
     void Disable();
     void DisplayFrame(CTcpData& data);
+    void DisplayFrame(CFrame* frame);
 
     void Process();
 
@@ -48,7 +50,8 @@ class CDebugWindow : public CThread
     int                      m_scale;
     CCondition               m_condition;
     bool                     m_process;
-    std::deque<CTcpData>     m_data;
+    CFramePool               m_pool;
+    std::deque<CFrame*>      m_data;
 
     Display*                 m_dpy;
     int                      m_width;
@@ -0,0 +1,163 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "eventloop.h"
+#include "log.h"
+#include "misc.h"
+#include "timeutils.h"
+
+#define MAXEVENTS 64
+
+CEventLoop::CEventLoop()
+{
+  m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epollfd == -1)
+    LogError("epoll_create1: %s", GetErrno().c_str());
+
+  m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_wakeupfd == -1)
+    LogError("eventfd: %s", GetErrno().c_str());
+
+  //the wakeup fd is the only one without a handler
+  if (m_epollfd != -1 && m_wakeupfd != -1)
+    Add(m_wakeupfd, EPOLLIN, NULL);
+}
+
+CEventLoop::~CEventLoop()
+{
+  if (m_wakeupfd != -1)
+    close(m_wakeupfd);
+  if (m_epollfd != -1)
+    close(m_epollfd);
+}
+
+bool CEventLoop::Add(int fd, uint32_t events, CEventHandler* handler)
+{
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.ptr = handler;
+
+  if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) == -1)
+  {
+    LogError("EPOLL_CTL_ADD: %s", GetErrno().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool CEventLoop::Modify(int fd, uint32_t events, CEventHandler* handler)
+{
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.ptr = handler;
+
+  if (epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event) == -1)
+  {
+    LogError("EPOLL_CTL_MOD: %s", GetErrno().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void CEventLoop::Remove(int fd)
+{
+  //the fd might have been closed already, which removes it too
+  struct epoll_event event = {};
+  epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, &event);
+}
+
+void CEventLoop::SetTimer(CEventHandler* handler, int64_t time)
+{
+  m_timers[handler] = time;
+}
+
+void CEventLoop::ClearTimer(CEventHandler* handler)
+{
+  m_timers.erase(handler);
+}
+
+bool CEventLoop::RunOnce(int64_t usecs)
+{
+  //wait until the first timer is due at most
+  int64_t now = GetTimeUs();
+  for (std::map<CEventHandler*, int64_t>::iterator it = m_timers.begin(); it != m_timers.end(); it++)
+  {
+    if (usecs < 0 || it->second - now < usecs)
+      usecs = Max(it->second - now, (int64_t)0);
+  }
+
+  //round up, so a timer doesn't fire a little early and makes this spin
+  int timeout = usecs < 0 ? -1 : (int)Min((usecs + 999) / 1000, (int64_t)1000000);
+
+  struct epoll_event events[MAXEVENTS];
+  int nrevents = epoll_wait(m_epollfd, events, MAXEVENTS, timeout);
+  if (nrevents == -1 && errno != EINTR)
+  {
+    LogError("epoll_wait: %s", GetErrno().c_str());
+    return false;
+  }
+
+  for (int i = 0; i < nrevents; i++)
+  {
+    CEventHandler* handler = (CEventHandler*)events[i].data.ptr;
+    if (handler)
+    {
+      handler->OnEvent(events[i].events);
+    }
+    else
+    {
+      uint64_t count;
+      if (read(m_wakeupfd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        LogError("reading wakeup fd: %s", GetErrno().c_str());
+    }
+  }
+
+  //a timer callback can set or clear timers, so look up the next one each time
+  now = GetTimeUs();
+  for (;;)
+  {
+    std::map<CEventHandler*, int64_t>::iterator it;
+    for (it = m_timers.begin(); it != m_timers.end(); it++)
+    {
+      if (it->second <= now)
+        break;
+    }
+
+    if (it == m_timers.end())
+      break;
+
+    CEventHandler* handler = it->first;
+    m_timers.erase(it);
+    handler->OnTimer();
+  }
+
+  return true;
+}
+
+void CEventLoop::Wakeup()
+{
+  uint64_t count = 1;
+  if (write(m_wakeupfd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    LogError("writing wakeup fd: %s", GetErrno().c_str());
+}
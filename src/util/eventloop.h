@@ -0,0 +1,66 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <map>
+#include <sys/epoll.h>
+
+#include "inclstdint.h"
+
+//gets called from CEventLoop::RunOnce() for its file descriptor and its timer
+class CEventHandler
+{
+  public:
+    virtual ~CEventHandler() {}
+
+    virtual void OnEvent(uint32_t events) {}
+    virtual void OnTimer() {}
+};
+
+//epoll based reactor, that drives any number of file descriptors and timers from one thread
+//everything except Wakeup() has to be called from the thread that calls RunOnce()
+class CEventLoop
+{
+  public:
+    CEventLoop();
+    ~CEventLoop();
+
+    bool Add(int fd, uint32_t events, CEventHandler* handler);
+    bool Modify(int fd, uint32_t events, CEventHandler* handler);
+    void Remove(int fd);
+
+    //calls OnTimer() of the handler once, at the absolute time from GetTimeUs()
+    void SetTimer(CEventHandler* handler, int64_t time);
+    void ClearTimer(CEventHandler* handler);
+
+    //waits at most usecs for events, -1 waits until an event, timer or wakeup
+    //returns false when epoll failed
+    bool RunOnce(int64_t usecs);
+
+    //makes RunOnce() return, can be called from any thread
+    void Wakeup();
+
+  private:
+    int                              m_epollfd;
+    int                              m_wakeupfd;
+    std::map<CEventHandler*, int64_t> m_timers;
+};
+
+#endif //EVENTLOOP_H
@@ -0,0 +1,100 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "frameencoder.h"
+
+CFrameEncoder::CFrameEncoder()
+{
+  m_rowbytes = 0;
+  m_lines = 0;
+  m_framecount = 0;
+  m_haveprevious = false;
+}
+
+void CFrameEncoder::SetSize(int columns, int lines)
+{
+  m_rowbytes = columns / 4;
+  m_lines = lines;
+  m_previous.resize(m_rowbytes * m_lines);
+  Reset();
+}
+
+void CFrameEncoder::Reset()
+{
+  m_haveprevious = false;
+  m_framecount = 0;
+}
+
+CTcpData& CFrameEncoder::Encode(CTcpData& frame)
+{
+  if (frame.GetSize() < 3 + m_rowbytes * m_lines || memcmp(frame.GetData(), ":00", 3) != 0)
+    return frame;
+
+  if (EncodeRows((const uint8_t*)frame.GetData() + 3, m_rowbytes))
+    return m_delta;
+  else
+    return frame;
+}
+
+bool CFrameEncoder::EncodeRows(const uint8_t* rows, int stride)
+{
+  //the row index is a single byte
+  if (m_lines >= DELTAEND)
+    return false;
+
+  bool keyframe = !m_haveprevious || m_framecount >= KEYFRAMEINTERVAL;
+
+  if (!keyframe)
+  {
+    m_buf.resize(3);
+    memcpy(&m_buf[0], ":01", 3);
+
+    for (int y = 0; y < m_lines; y++)
+    {
+      const uint8_t* row = rows + y * stride;
+      if (memcmp(row, &m_previous[y * m_rowbytes], m_rowbytes) != 0)
+      {
+        m_buf.push_back(y);
+        m_buf.insert(m_buf.end(), row, row + m_rowbytes);
+      }
+    }
+
+    m_buf.push_back(DELTAEND);
+    m_buf.resize(m_buf.size() + 10, 0);
+
+    //when most rows changed, the full frame is smaller
+    if ((int)m_buf.size() >= 3 + m_rowbytes * m_lines + 10)
+      keyframe = true;
+  }
+
+  for (int y = 0; y < m_lines; y++)
+    memcpy(&m_previous[y * m_rowbytes], rows + y * stride, m_rowbytes);
+  m_haveprevious = true;
+
+  if (keyframe)
+  {
+    m_framecount = 0;
+    return false;
+  }
+
+  m_framecount++;
+  m_delta.SetData(&m_buf[0], m_buf.size());
+  return true;
+}
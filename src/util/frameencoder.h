@@ -0,0 +1,64 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEENCODER_H
+#define FRAMEENCODER_H
+
+#include <vector>
+
+#include "inclstdint.h"
+#include "tcpsocket.h"
+
+//a full frame is ":00", every row of pixels, then 10 zero bytes
+//a delta frame is ":01", then for every changed row its index followed by the row,
+//then DELTAEND and 10 zero bytes
+#define DELTAEND 0xFF
+
+//send a full frame at least this often, so a receiver that lost sync recovers
+#define KEYFRAMEINTERVAL 30
+
+//turns full frames into delta frames against the previous frame sent to the same receiver
+class CFrameEncoder
+{
+  public:
+    CFrameEncoder();
+
+    void SetSize(int columns, int lines);
+
+    //the next frame is sent whole, call this when the receiver might have lost the previous frame
+    void Reset();
+
+    //returns either the full frame or a delta frame, whichever is smaller
+    CTcpData& Encode(CTcpData& frame);
+
+    //same as Encode(), for rows that are stride bytes apart
+    //returns true when Delta() holds a delta frame, false when the full frame should be sent
+    bool      EncodeRows(const uint8_t* rows, int stride);
+    CTcpData& Delta() { return m_delta; }
+
+  private:
+    int                  m_rowbytes;
+    int                  m_lines;
+    int                  m_framecount;
+    bool                 m_haveprevious;
+    std::vector<uint8_t> m_previous;
+    std::vector<uint8_t> m_buf;
+    CTcpData             m_delta;
+};
+
+#endif //FRAMEENCODER_H
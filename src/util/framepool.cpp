@@ -0,0 +1,103 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framepool.h"
+#include "lock.h"
+
+CFrame::CFrame(CFramePool* pool)
+{
+  m_refs = 0;
+  m_capacity = 0;
+  m_pool = pool;
+}
+
+void CFrame::AddRef()
+{
+  __atomic_add_fetch(&m_refs, 1, __ATOMIC_RELAXED);
+}
+
+void CFrame::Release()
+{
+  if (__atomic_sub_fetch(&m_refs, 1, __ATOMIC_ACQ_REL) == 0)
+    m_pool->ReturnFrame(this);
+}
+
+CFramePool::CFramePool()
+{
+  m_framesize = 0;
+  m_allocations = 0;
+}
+
+CFramePool::~CFramePool()
+{
+  for (size_t i = 0; i < m_frames.size(); i++)
+    delete m_frames[i];
+}
+
+void CFramePool::SetFrameSize(int size)
+{
+  CLock lock(m_mutex);
+  m_framesize = size;
+}
+
+CFrame* CFramePool::GetFrame()
+{
+  CLock lock(m_mutex);
+
+  CFrame* frame;
+  if (m_free.empty())
+  {
+    frame = new CFrame(this);
+    frame->m_data.Reserve(m_framesize);
+    frame->m_capacity = frame->m_data.Capacity();
+    m_frames.push_back(frame);
+    m_free.reserve(m_frames.size());
+    m_allocations++;
+  }
+  else
+  {
+    frame = m_free.back();
+    m_free.pop_back();
+  }
+  lock.Leave();
+
+  frame->m_data.Clear();
+  frame->m_refs = 1;
+
+  return frame;
+}
+
+int64_t CFramePool::Allocations()
+{
+  CLock lock(m_mutex);
+  return m_allocations;
+}
+
+void CFramePool::ReturnFrame(CFrame* frame)
+{
+  CLock lock(m_mutex);
+
+  //count it when a frame outgrew its buffer
+  if (frame->m_data.Capacity() != frame->m_capacity)
+  {
+    frame->m_capacity = frame->m_data.Capacity();
+    m_allocations++;
+  }
+
+  m_free.push_back(frame);
+}
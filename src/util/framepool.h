@@ -0,0 +1,80 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <vector>
+
+#include "inclstdint.h"
+#include "mutex.h"
+#include "tcpsocket.h"
+
+class CFramePool;
+
+//a reference counted frame buffer, that is passed between threads instead of copied
+//it goes back to its pool when the last reference is released
+class CFrame
+{
+  public:
+    CTcpData& Data() { return m_data; }
+
+    void AddRef();
+    void Release();
+
+  private:
+    friend class CFramePool;
+
+    CFrame(CFramePool* pool);
+
+    CTcpData    m_data;
+    int         m_refs;
+    int         m_capacity;
+    CFramePool* m_pool;
+};
+
+//keeps released frames for reuse, so that once every buffer has grown to
+//the size of a frame, rendering and sending frames doesn't allocate anymore
+class CFramePool
+{
+  public:
+    CFramePool();
+    ~CFramePool();
+
+    //bytes reserved in every new frame
+    void    SetFrameSize(int size);
+
+    //returns an empty frame with one reference
+    CFrame* GetFrame();
+
+    //number of times a frame was allocated, or a frame buffer had to grow
+    int64_t Allocations();
+
+  private:
+    friend class CFrame;
+
+    void ReturnFrame(CFrame* frame);
+
+    CMutex               m_mutex;
+    std::vector<CFrame*> m_frames;
+    std::vector<CFrame*> m_free;
+    int                  m_framesize;
+    int64_t              m_allocations;
+};
+
+#endif //FRAMEPOOL_H
@@ -0,0 +1,87 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "latencyhistogram.h"
+
+CLatencyHistogram::CLatencyHistogram()
+{
+  Reset();
+}
+
+void CLatencyHistogram::Add(int64_t usecs)
+{
+  if (usecs < 0)
+    usecs = 0;
+
+  int bucket;
+  if (usecs < FINEBUCKETS)
+    bucket = usecs;
+  else if (usecs < FINEBUCKETS + COARSEBUCKETS * COARSESIZE)
+    bucket = FINEBUCKETS + (usecs - FINEBUCKETS) / COARSESIZE;
+  else
+    bucket = FINEBUCKETS + COARSEBUCKETS;
+
+  m_buckets[bucket]++;
+  m_count++;
+  if (usecs > m_max)
+    m_max = usecs;
+}
+
+void CLatencyHistogram::Reset()
+{
+  memset(m_buckets, 0, sizeof(m_buckets));
+  m_count = 0;
+  m_max = 0;
+}
+
+int64_t CLatencyHistogram::Percentile(double percentile)
+{
+  if (m_count == 0)
+    return 0;
+
+  int64_t needed = (int64_t)(m_count * percentile / 100.0 + 0.5);
+  if (needed < 1)
+    needed = 1;
+
+  int64_t counted = 0;
+  for (int i = 0; i < FINEBUCKETS + COARSEBUCKETS; i++)
+  {
+    counted += m_buckets[i];
+    if (counted >= needed)
+    {
+      if (i < FINEBUCKETS)
+        return i;
+      else
+        return FINEBUCKETS + (i - FINEBUCKETS + 1) * COARSESIZE - 1;
+    }
+  }
+
+  return m_max;
+}
+
+std::string CLatencyHistogram::ToString()
+{
+  char buf[128];
+  snprintf(buf, sizeof(buf), "p50 %lli us p99 %lli us max %lli us",
+           (long long)Percentile(50.0), (long long)Percentile(99.0), (long long)m_max);
+
+  return buf;
+}
@@ -0,0 +1,56 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <string>
+
+#include "inclstdint.h"
+
+#define FINEBUCKETS   1000
+#define COARSEBUCKETS 990
+#define COARSESIZE    100
+
+//counts latencies in microseconds, with 1 us buckets below 1 ms and 100 us buckets up to 100 ms,
+//longer latencies go into one overflow bucket, the maximum is exact
+//adding doesn't allocate, so it can be used from realtime threads
+class CLatencyHistogram
+{
+  public:
+    CLatencyHistogram();
+
+    void    Add(int64_t usecs);
+    void    Reset();
+
+    int64_t Count() { return m_count; }
+    int64_t Max()   { return m_max;   }
+
+    //returns the upper edge of the bucket that holds the given percentile
+    int64_t Percentile(double percentile);
+
+    //"p50 x us p99 x us max x us"
+    std::string ToString();
+
+  private:
+    int64_t m_buckets[FINEBUCKETS + COARSEBUCKETS + 1];
+    int64_t m_count;
+    int64_t m_max;
+};
+
+#endif //LATENCYHISTOGRAM_H
@@ -0,0 +1,144 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "ringbuffer.h"
+
+static uint32_t NextPowerOfTwo(int value)
+{
+  uint32_t power = 1;
+  while (power < (uint32_t)value)
+    power <<= 1;
+
+  return power;
+}
+
+CRingBuffer::CRingBuffer()
+{
+  m_samples    = NULL;
+  m_size       = 0;
+  m_blocks     = NULL;
+  m_nrblocks   = 0;
+  m_writepos   = 0;
+  m_readpos    = 0;
+  m_blockwrite = 0;
+  m_blockread  = 0;
+  m_overruns   = 0;
+}
+
+CRingBuffer::~CRingBuffer()
+{
+  Free();
+}
+
+//sizes are rounded up to a power of two, so the counters can wrap around freely
+//this should not be called while the producer or consumer is running
+void CRingBuffer::Allocate(int minsamples, int minblocks)
+{
+  Free();
+
+  m_size     = NextPowerOfTwo(minsamples);
+  m_samples  = (float*)malloc(m_size * sizeof(float));
+  m_nrblocks = NextPowerOfTwo(minblocks);
+  m_blocks   = (block*)malloc(m_nrblocks * sizeof(block));
+}
+
+void CRingBuffer::Free()
+{
+  free(m_samples);
+  m_samples = NULL;
+  m_size = 0;
+  free(m_blocks);
+  m_blocks = NULL;
+  m_nrblocks = 0;
+
+  m_writepos   = 0;
+  m_readpos    = 0;
+  m_blockwrite = 0;
+  m_blockread  = 0;
+}
+
+int CRingBuffer::GetWriteSpans(float*& span1, int& size1, float*& span2, int& size2)
+{
+  uint32_t writepos = m_writepos;
+  uint32_t readpos  = __atomic_load_n(&m_readpos, __ATOMIC_ACQUIRE);
+
+  //if there's no room for another block, there's no room for samples either
+  if (m_blockwrite - __atomic_load_n(&m_blockread, __ATOMIC_ACQUIRE) >= m_nrblocks)
+  {
+    size1 = size2 = 0;
+    return 0;
+  }
+
+  uint32_t space = m_size - (writepos - readpos);
+  uint32_t index = writepos & (m_size - 1);
+
+  span1 = m_samples + index;
+  size1 = space < m_size - index ? space : m_size - index;
+  span2 = m_samples;
+  size2 = space - size1;
+
+  return space;
+}
+
+void CRingBuffer::CommitWrite(int samples, int64_t time)
+{
+  if (samples <= 0)
+    return;
+
+  block& newblock = m_blocks[m_blockwrite & (m_nrblocks - 1)];
+  newblock.start = m_writepos;
+  newblock.time  = time;
+
+  //publish the block before the samples, so the consumer always has a block for every sample it sees
+  __atomic_store_n(&m_blockwrite, m_blockwrite + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&m_writepos, m_writepos + samples, __ATOMIC_RELEASE);
+}
+
+int CRingBuffer::GetReadSpan(float*& span, int64_t& blocktime, int& blockoffset)
+{
+  uint32_t readpos    = m_readpos;
+  uint32_t available  = __atomic_load_n(&m_writepos, __ATOMIC_ACQUIRE) - readpos;
+  uint32_t blockwrite = __atomic_load_n(&m_blockwrite, __ATOMIC_ACQUIRE);
+
+  //skip over blocks that have been read completely, this is also done when the buffer is empty
+  //otherwise the producer could run out of blocks
+  uint32_t blockread = m_blockread;
+  while (blockwrite - blockread > 1 && (int32_t)(m_blocks[(blockread + 1) & (m_nrblocks - 1)].start - readpos) <= 0)
+    blockread++;
+
+  __atomic_store_n(&m_blockread, blockread, __ATOMIC_RELEASE);
+
+  if (available == 0)
+    return 0;
+
+  const block& currblock = m_blocks[blockread & (m_nrblocks - 1)];
+  blocktime   = currblock.time;
+  blockoffset = readpos - currblock.start;
+
+  uint32_t index = readpos & (m_size - 1);
+  span = m_samples + index;
+
+  return available < m_size - index ? available : m_size - index;
+}
+
+void CRingBuffer::CommitRead(int samples)
+{
+  __atomic_store_n(&m_readpos, m_readpos + samples, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,72 @@
+/*
+ * bitvis
+ * Copyright (C) Bob 2012
+ *
+ * bitvis is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bitvis is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "inclstdint.h"
+
+//wait-free single producer, single consumer ring buffer for audio samples
+//every write is stored as a block with a timestamp, so the consumer can find
+//the time of every sample it reads
+//the producer only calls GetWriteSpans() and CommitWrite(),
+//the consumer only calls GetReadSpan() and CommitRead()
+class CRingBuffer
+{
+  public:
+    CRingBuffer();
+    ~CRingBuffer();
+
+    void Allocate(int minsamples, int minblocks);
+    void Free();
+
+    //returns the number of samples that can be written, spread over two spans
+    int  GetWriteSpans(float*& span1, int& size1, float*& span2, int& size2);
+    void CommitWrite(int samples, int64_t time);
+    void Overrun() { __atomic_add_fetch(&m_overruns, 1, __ATOMIC_RELAXED); }
+
+    //returns the number of samples in the contiguous span at the read position
+    //blocktime is the timestamp of the block the span starts in,
+    //blockoffset is the number of samples from the start of that block
+    int  GetReadSpan(float*& span, int64_t& blocktime, int& blockoffset);
+    void CommitRead(int samples);
+
+    int64_t Overruns() { return __atomic_load_n(&m_overruns, __ATOMIC_RELAXED); }
+
+  private:
+    struct block
+    {
+      uint32_t start;
+      int64_t  time;
+    };
+
+    float*   m_samples;
+    uint32_t m_size;
+    block*   m_blocks;
+    uint32_t m_nrblocks;
+
+    //these are free running counters, the buffer index is the counter modulo the size
+    uint32_t m_writepos;
+    uint32_t m_readpos;
+    uint32_t m_blockwrite;
+    uint32_t m_blockread;
+
+    int64_t  m_overruns;
+};
+
+#endif //RINGBUFFER_H
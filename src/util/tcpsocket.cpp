@@ -24,9 +24,13 @@
 #include <sys/fcntl.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "tcpsocket.h"
 #include "misc.h"
+#include "timeutils.h"
 
 using namespace std;
 
@@ -50,13 +54,13 @@ void CTcpData::SetData(const char* data, int size, bool append)
   CopyData(const_cast<char*>(data), size, append);
 }*/
 
-void CTcpData::SetData(std::string data, bool append)
+void CTcpData::SetData(const std::string& data, bool append)
 {
-  CopyData(const_cast<char*>(data.c_str()), data.length(), append);
+  CopyData(data.c_str(), data.length(), append);
 }
 
 //store data as c-string
-void CTcpData::CopyData(char* data, int size, bool append)
+void CTcpData::CopyData(const char* data, int size, bool append)
 {
   if (append)
   {
@@ -83,6 +87,7 @@ CTcpSocket::CTcpSocket()
 {
   m_sock = -1;
   m_port = -1;
+  m_usectimeout = -1;
 }
 
 CTcpSocket::~CTcpSocket()
@@ -193,38 +198,29 @@ int CTcpSocket::SetKeepalive()
 }
 
 //wait until the socket becomes readable or writeable
+//poll() has no limit on the fd number, unlike select()
 int CTcpSocket::WaitForSocket(bool write, std::string timeoutstr)
 {
   int returnv;
-  fd_set rwsock;
-  struct timeval *tv = NULL;
+  struct pollfd pollsock = {};
+  pollsock.fd = m_sock;
+  pollsock.events = write ? POLLOUT : POLLIN;
 
-  //add the socket to the fd_set
-  FD_ZERO(&rwsock);
-  FD_SET(m_sock, &rwsock);
+  //set the timeout, rounded up to milliseconds, a negative timeout waits forever
+  int timeout = -1;
+  if (m_usectimeout >= 0)
+    timeout = (m_usectimeout + 999) / 1000;
 
-  //set the timeout
-  struct timeval timeout;
-  if (m_usectimeout > 0)
-  {
-    timeout.tv_sec = m_usectimeout / 1000000;
-    timeout.tv_usec = m_usectimeout % 1000000;
-    tv = &timeout;
-  }
-
-  if (write)
-    returnv = select(m_sock + 1, NULL, &rwsock, NULL, tv);
-  else
-    returnv = select(m_sock + 1, &rwsock, NULL, NULL, tv);
+  returnv = poll(&pollsock, 1, timeout);
   
-  if (returnv == 0) //select timed out
+  if (returnv == 0) //poll timed out
   {
     m_error = m_address + ":" + ToString(m_port) + " " + timeoutstr + " timed out"; 
     return TIMEOUT;
   }
-  else if (returnv == -1) //select had an error
+  else if (returnv == -1) //poll had an error
   {
-    m_error = "select() " + GetErrno();
+    m_error = "poll() " + GetErrno();
     return FAIL;
   }
 
@@ -246,6 +242,12 @@ int CTcpSocket::WaitForSocket(bool write, std::string timeoutstr)
   return SUCCESS;
 }
 
+CTcpClientSocket::CTcpClientSocket()
+{
+  m_addrindex = 0;
+  ResetWriteStats();
+}
+
 //open a client socket
 int CTcpClientSocket::Open(std::string address, int port, int usectimeout /*= -1*/)
 {
@@ -298,6 +300,118 @@ int CTcpClientSocket::Open(std::string address, int port, int usectimeout /*= -1
   return SUCCESS;
 }
 
+//looks up the host once, so reconnecting doesn't have to wait for a lookup
+int CTcpClientSocket::Resolve(std::string address, int port)
+{
+  m_address = address;
+  m_port = port;
+  m_addrs.clear();
+  m_addrlens.clear();
+  m_addrindex = 0;
+
+  struct addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *addrinfo;
+  int rv = getaddrinfo(address.c_str(), ToString(port).c_str(), &hints, &addrinfo);
+  if (rv) //can't find host
+  {
+    m_error = "getaddrinfo() " + address + ":" + ToString(m_port) + " " + gai_strerror(rv);
+    return FAIL;
+  }
+
+  for (struct addrinfo *rp = addrinfo; rp != NULL; rp = rp->ai_next)
+  {
+    if (rp->ai_addrlen > sizeof(struct sockaddr_storage))
+      continue;
+
+    struct sockaddr_storage addr = {};
+    memcpy(&addr, rp->ai_addr, rp->ai_addrlen);
+    m_addrs.push_back(addr);
+    m_addrlens.push_back(rp->ai_addrlen);
+  }
+
+  freeaddrinfo(addrinfo);
+
+  return SUCCESS;
+}
+
+//starts a non-blocking connect, from the current resolved address on until one of them starts,
+//when they all fail it starts from the first one again the next time
+int CTcpClientSocket::OpenNonBlock()
+{
+  Close(); //close it if it was opened
+
+  //the event loop waits for the socket, reads and writes should not wait again
+  m_usectimeout = 0;
+
+  if (m_addrs.empty())
+  {
+    m_error = m_address + ":" + ToString(m_port) + " has no resolved address";
+    return FAIL;
+  }
+
+  for (; m_addrindex < m_addrs.size(); m_addrindex++)
+  {
+    m_sock = socket(m_addrs[m_addrindex].ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (m_sock == -1) //can't make socket
+    {
+      m_error = "socket() " + GetErrno();
+      continue;
+    }
+
+    if (SetNonBlock() != SUCCESS)
+    {
+      Close();
+      continue;
+    }
+
+    if (connect(m_sock, reinterpret_cast<struct sockaddr*>(&m_addrs[m_addrindex]), m_addrlens[m_addrindex]) != -1 ||
+        errno == EINPROGRESS)
+      return SUCCESS;
+
+    m_error = "connect() " + m_address + ":" + ToString(m_port) + " " + GetErrno();
+    Close();
+  }
+
+  m_addrindex = 0;
+  return FAIL;
+}
+
+bool CTcpClientSocket::NextAddress()
+{
+  if (m_addrindex + 1 < m_addrs.size())
+  {
+    m_addrindex++;
+    return true;
+  }
+
+  m_addrindex = 0;
+  return false;
+}
+
+//checks the result of OpenNonBlock(), once the socket is writeable
+int CTcpClientSocket::FinishConnect()
+{
+  int sockstate;
+  socklen_t sockstatelen = sizeof(sockstate);
+  if (getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &sockstate, &sockstatelen) == -1)
+  {
+    m_error = "getsockopt() " + GetErrno();
+    return FAIL;
+  }
+  else if (sockstate)
+  {
+    m_error = "connect() " + m_address + ":" + ToString(m_port) + " " + GetErrno(sockstate);
+    return FAIL;
+  }
+
+  //if this fails the socket might still work, so don't return an error
+  SetSockOptions();
+
+  return SUCCESS;
+}
+
 int CTcpClientSocket::Read(CTcpData& data)
 {
   uint8_t buff[1000];
@@ -353,6 +467,7 @@ int CTcpClientSocket::Write(CTcpData& data)
     return FAIL;
   }
 
+  int64_t start = GetTimeUs();
   int bytestowrite = data.GetSize();
   int byteswritten = 0;
 
@@ -375,9 +490,62 @@ int CTcpClientSocket::Write(CTcpData& data)
 
     byteswritten += size;
   }
+
+  AddWriteTime(GetTimeUs() - start);
+
+  return SUCCESS;
+}
+
+int CTcpClientSocket::TryWrite(struct iovec* iov, int iovcnt, int& byteswritten)
+{
+  byteswritten = 0;
+
+  if (m_sock == -1)
+  {
+    m_error = "socket closed";
+    return FAIL;
+  }
+
+  int64_t start = GetTimeUs();
+  ssize_t size = writev(m_sock, iov, Min(iovcnt, IOV_MAX));
+  AddWriteTime(GetTimeUs() - start);
+
+  if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+  {
+    return SUCCESS;
+  }
+  else if (size == -1)
+  {
+    m_error = "writev() " + m_address + ":" + ToString(m_port) + " " + GetErrno();
+    return FAIL;
+  }
+
+  byteswritten = size;
   return SUCCESS;
 }
 
+void CTcpClientSocket::GetWriteStats(int64_t& writes, int64_t& totaltime, int64_t& maxtime)
+{
+  writes = m_writes;
+  totaltime = m_writetime;
+  maxtime = m_maxwritetime;
+}
+
+void CTcpClientSocket::ResetWriteStats()
+{
+  m_writes = 0;
+  m_writetime = 0;
+  m_maxwritetime = 0;
+}
+
+void CTcpClientSocket::AddWriteTime(int64_t time)
+{
+  m_writes++;
+  m_writetime += time;
+  if (time > m_maxwritetime)
+    m_maxwritetime = time;
+}
+
 int CTcpClientSocket::SetInfo(std::string address, int port, int sock)
 {
   m_address = address;
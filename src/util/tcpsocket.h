@@ -20,7 +20,9 @@
 #define TCP
 
 #include <string>
+#include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 #include <vector>
 
 #define FAIL    0
@@ -34,16 +36,19 @@ class CTcpData
     /*void SetData(char* data, int size, bool append = false);
     void SetData(const uint8_t* data, int size, bool append = false);
     void SetData(const char* data, int size, bool append = false);*/
-    void SetData(std::string data, bool append = false);
+    void SetData(const std::string& data, bool append = false);
 
     int   GetSize() { return m_data.size() - 1; }
     char* GetData() { return &m_data[0]; }
                                                                                           
     void Clear();
+    void Resize(int size)  { m_data.resize(size + 1); m_data.back() = 0; }
+    void Reserve(int size) { m_data.reserve(size + 1); }
+    int  Capacity()        { return m_data.capacity() - 1; }
 
   private:
     std::vector<char> m_data;
-    void CopyData(char* data, int size, bool append);
+    void CopyData(const char* data, int size, bool append);
 };
 
 class CTcpSocket //base class
@@ -61,7 +66,7 @@ class CTcpSocket //base class
     int         GetPort()    { return m_port; }
     int         GetSock()    { return m_sock; }
 
-    void        SetTimeout(int usectimeout) { m_usectimeout = usectimeout; }
+    void        SetTimeout(int usectimeout) { m_usectimeout = usectimeout; } //-1 waits forever
     
   protected:
     std::string m_address;
@@ -80,10 +85,32 @@ class CTcpSocket //base class
 class CTcpClientSocket : public CTcpSocket
 {
   public:
+    CTcpClientSocket();
+
     int Open(std::string address, int port, int usectimeout = -1);
+    int Resolve(std::string address, int port); //looks up all addresses of the host, this blocks
+    int OpenNonBlock(); //starts connecting to a resolved address, wait until writeable then call FinishConnect()
+    int FinishConnect();
+    bool NextAddress(); //moves to the next resolved address, false when all of them were tried
     int Read(CTcpData& data);
     int Write(CTcpData& data);
+    int TryWrite(struct iovec* iov, int iovcnt, int& byteswritten); //writes what fits in the socket buffer without waiting
     int SetInfo(std::string address, int port, int sock);
+
+    //number of writes, and their total and maximum duration in microseconds, since the last reset
+    void GetWriteStats(int64_t& writes, int64_t& totaltime, int64_t& maxtime);
+    void ResetWriteStats();
+
+  private:
+    void AddWriteTime(int64_t time);
+
+    std::vector<struct sockaddr_storage> m_addrs;
+    std::vector<socklen_t>               m_addrlens;
+    size_t                               m_addrindex;
+
+    int64_t m_writes;
+    int64_t m_writetime;
+    int64_t m_maxwritetime;
 };
 
 class CTcpServerSocket : public CTcpSocket
@@ -21,6 +21,7 @@
 CThread::CThread()
 {
   m_running = false;
+  m_started = false;
 }
 
 CThread::~CThread()
@@ -31,15 +32,17 @@ CThread::~CThread()
 void CThread::StartThread()
 {
   m_stop = false;
-  m_running = true;
-  pthread_create(&m_thread, NULL, ThreadFunction, reinterpret_cast<void*>(this));
+  __atomic_store_n(&m_running, true, __ATOMIC_RELEASE);
+  m_started = pthread_create(&m_thread, NULL, ThreadFunction, reinterpret_cast<void*>(this)) == 0;
+  if (!m_started)
+    __atomic_store_n(&m_running, false, __ATOMIC_RELEASE);
 }
 
 void* CThread::ThreadFunction(void* args)
 {
   CThread* thread = reinterpret_cast<CThread*>(args);
   thread->Process();
-  thread->m_running = false;
+  __atomic_store_n(&thread->m_running, false, __ATOMIC_RELEASE);
 
   return NULL;
 }
@@ -59,14 +62,18 @@ void CThread::AsyncStopThread()
   m_stop = true;
 }
 
+//a thread that already returned from Process() still has to be joined, or its stack leaks
 void CThread::JoinThread()
 {
-  if (m_running)
+  if (m_started)
+  {
     pthread_join(m_thread, NULL);
+    m_started = false;
+  }
 }
 
 bool CThread::IsRunning()
 {
-  return m_running;
+  return __atomic_load_n(&m_running, __ATOMIC_ACQUIRE);
 }
 
@@ -40,7 +40,8 @@ class CThread
   protected:
     pthread_t     m_thread;
     volatile bool m_stop;
-    volatile bool m_running;
+    volatile bool m_running; //cleared when Process() returns
+    bool          m_started; //set until the thread is joined, even when Process() returned on its own
 
     static void* ThreadFunction(void* args);
     virtual void Process();
@@ -16,6 +16,8 @@
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+
 #include "timeutils.h"
 
 void USleep(int64_t usecs, volatile bool* stop /*= NULL*/)
@@ -54,3 +56,21 @@ void USleep(int64_t usecs, volatile bool* stop /*= NULL*/)
   }
 }
 
+
+void USleepUntil(int64_t time, int64_t spinus /*= 0*/)
+{
+  int64_t sleepuntil = time - spinus;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_NANOSLEEP) && defined(CLOCK_MONOTONIC)
+  //GetTimeUs() uses the same clock
+  struct timespec sleeptime;
+  sleeptime.tv_sec = sleepuntil / 1000000;
+  sleeptime.tv_nsec = (sleepuntil % 1000000) * 1000;
+
+  while (sleepuntil > GetTimeUs() && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sleeptime, NULL) == EINTR);
+#else
+  USleep(sleepuntil - GetTimeUs());
+#endif
+
+  while (GetTimeUs() < time);
+}
@@ -38,6 +38,18 @@ inline int64_t GetTimeUs()
 #endif
 }
 
+//cpu time used by the calling thread, falls back to wall clock time
+inline int64_t GetThreadCpuTimeUs()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return ((int64_t)time.tv_sec * 1000000LL) + (int64_t)(time.tv_nsec + 500) / 1000LL;
+#else
+  return GetTimeUs();
+#endif
+}
+
 template <class T> 
 inline T GetTimeSec()
 {
@@ -46,4 +58,8 @@ inline T GetTimeSec()
 
 void USleep(int64_t usecs, volatile bool* stop = NULL);
 
+//sleeps until the absolute time from GetTimeUs(), so oversleeping doesn't add up when called in a loop
+//the last spinus microseconds are busy waited, which is more precise than the scheduler
+void USleepUntil(int64_t time, int64_t spinus = 0);
+
 #endif //TIMEUTILS